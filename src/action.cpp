@@ -105,6 +105,10 @@ bool		Interface::check_events()
 			show_info();
 			break;
 
+		case PEND_MEMSTATS:
+			show_memstats();
+			break;
+
 		/*
 		 * MPD admin
 		 */
@@ -299,19 +303,23 @@ long		Interface::shell(string command)
  */
 long		Interface::show_info()
 {
+	Songlist *	songlist;
+	ListItemSong *	list_item;
 	Song *		song;
 
-	song = pms->disp->cursorsong();
-	if (song == NULL)
+	songlist = SONGLIST(pms->disp->active_list);
+	if (songlist == NULL || (list_item = LISTITEMSONG(songlist->cursor_item())) == NULL)
 	{
 		pms->log(MSG_STATUS, STERR, _("No info could be retrieved."));
 		return STERR;
 	}
 
+	song = list_item->song;
+
 	pms->log(MSG_STATUS, STOK, "%s%s", pms->options->libraryroot.c_str(), song->file.c_str());
 	pms->log(MSG_CONSOLE, STOK, _("--- song info ---\n"));
-	pms->log(MSG_CONSOLE, STOK, "id\t\t = %d\n", song->id);
-	pms->log(MSG_CONSOLE, STOK, "pos\t\t = %d\n", song->pos);
+	pms->log(MSG_CONSOLE, STOK, "id\t\t = %d\n", list_item->id);
+	pms->log(MSG_CONSOLE, STOK, "pos\t\t = %d\n", list_item->pos);
 	pms->log(MSG_CONSOLE, STOK, "file\t\t = %s%s\n", pms->options->libraryroot.c_str(), song->file.c_str());
 	pms->log(MSG_CONSOLE, STOK, "artist\t\t = %s\n", song->artist.c_str());
 	pms->log(MSG_CONSOLE, STOK, "albumartist\t = %s\n", song->albumartist.c_str());
@@ -328,6 +336,30 @@ long		Interface::show_info()
 	return STOK;
 }
 
+/*
+ * Show how much memory the tag pool is saving
+ */
+long		Interface::show_memstats()
+{
+	Tagpool &	tp = Tag::pool();
+
+	pms->log(MSG_STATUS, STOK, _("Tag pool: %lu strings, %lu KiB stored, %lu KiB saved by sharing"),
+			tp.size(), tp.stored_bytes() / 1024, tp.saved_bytes() / 1024);
+	pms->log(MSG_CONSOLE, STOK, "RSS\t\t = %ld KiB\n", current_rss());
+	pms->log(MSG_CONSOLE, STOK, "peak RSS\t = %ld KiB\n", peak_rss());
+	pms->log(MSG_CONSOLE, STOK, "song records\t = %lu\n", Song::count());
+	pms->log(MSG_CONSOLE, STOK, "song slab\t = %lu live, %lu allocations, %lu KiB\n",
+			Song::slab().live(), Song::slab().allocations(), Song::slab().bytes() / 1024);
+	pms->log(MSG_CONSOLE, STOK, "list item slab\t = %lu live, %lu allocations, %lu KiB\n",
+			ListItemSong::slab().live(), ListItemSong::slab().allocations(), ListItemSong::slab().bytes() / 1024);
+	pms->log(MSG_CONSOLE, STOK, "tag strings\t = %lu\n", tp.size());
+	pms->log(MSG_CONSOLE, STOK, "tag references\t = %lu\n", tp.references());
+	pms->log(MSG_CONSOLE, STOK, "bytes stored\t = %lu\n", tp.stored_bytes());
+	pms->log(MSG_CONSOLE, STOK, "bytes saved\t = %lu\n", tp.saved_bytes());
+
+	return STOK;
+}
+
 /*
  * Clear the filter list
  *
@@ -461,7 +493,7 @@ long		Interface::update_db(string location)
 long		Interface::play()
 {
 	Songlist *	songlist;
-	Song *		song;
+	ListItemSong *	list_item;
 	song_t		s;
 
 	songlist = dynamic_cast<Songlist *>(pms->disp->active_list);
@@ -470,16 +502,16 @@ long		Interface::play()
 		return STERR;
 	}
 
-	song = songlist->cursorsong();
-	assert(song != NULL);
+	list_item = LISTITEMSONG(songlist->cursor_item());
+	assert(list_item != NULL);
 
-	pms->log(MSG_CONSOLE, STOK, "Playing %s\n", song->file.c_str());
+	pms->log(MSG_CONSOLE, STOK, "Playing %s\n", list_item->song->file.c_str());
 
-	s = song->id;
+	s = list_item->id;
 
-	if (song->id == MPD_SONG_NO_ID)
+	if (list_item->id == MPD_SONG_NO_ID)
 	{
-		s = pms->comm->add(pms->comm->queue(), song);
+		s = pms->comm->add(pms->comm->queue(), list_item->song);
 		if (s == MPD_SONG_NO_ID)
 		{
 			generr();
@@ -503,6 +535,10 @@ long		Interface::add(string param)
 {
 	vector<ListItem *>::iterator	selection_iterator;
 
+	vector<ListItemSong *>		items;
+	vector<Song *>			songs;
+	vector<bool>			succeeded;
+
 	ListItemSong *	list_item;
 	Songlist *	songlist;
 	Songlist *	dlist;
@@ -543,7 +579,7 @@ long		Interface::add(string param)
 	/* Add arbitrary file or stream */
 	if (param.size() > 0)
 	{
-		song = new Song(param);
+		song = Song::acquire(param);
 		if (pms->comm->add(dlist, song) != MPD_SONG_NO_ID) {
 			pms->log(MSG_STATUS, STOK, _("Added '%s' to %s."), param.c_str(), dlist->title());
 		} else {
@@ -551,7 +587,7 @@ long		Interface::add(string param)
 			generr();
 		}
 
-		delete song;
+		song->release();
 		return STOK;
 	}
 
@@ -559,16 +595,21 @@ long		Interface::add(string param)
 	selection_iterator = songlist->selection_begin();
 	while (selection_iterator != songlist->selection_end()) {
 		list_item = LISTITEMSONG(*selection_iterator);
-		song = list_item->song;
-		pms->log(MSG_DEBUG, 0, "Adding song at %p with id=%d pos=%d filename=%s\n", song, song->id, song->pos, song->file.c_str());
-		if (pms->comm->add(dlist, song) != MPD_SONG_NO_ID) {
-			list_item->set_selected(false);
+		items.push_back(list_item);
+		songs.push_back(list_item->song);
+		++selection_iterator;
+	}
+
+	pms->comm->add(dlist, songs, succeeded);
+
+	/* Songs that could not be added stay selected */
+	for (size_t n = 0; n < items.size(); ++n) {
+		if (succeeded[n]) {
+			items[n]->set_selected(false);
 			++i;
 		} else {
-			/* FIXME: proper error handling */
-			generr();
+			pms->log(MSG_DEBUG, 0, "Could not add %s to %s\n", songs[n]->file.c_str(), dlist->title());
 		}
-		++selection_iterator;
 	}
 
 	if (i == 0) {
@@ -617,7 +658,7 @@ Interface::prev()
 	}
 	else
 	{
-		if (cs->pos <= 0)
+		if (pms->cursong_pos() <= 0)
 		{
 			if (pms->comm->status()->repeat) {
 				i = pms->comm->queue()->size();
@@ -630,7 +671,7 @@ Interface::prev()
 		}
 		else
 		{
-			i = cs->pos;
+			i = pms->cursong_pos();
 		}
 	}
 
@@ -641,8 +682,7 @@ Interface::prev()
 		return STERR;
 	}
 
-	cs = pms->comm->queue()->song(i);
-	pms->comm->playid(cs->id);
+	pms->comm->playid(pms->comm->queue()->song_item(i)->id);
 	//pms->drawstatus();
 
 	return STOK;
@@ -937,6 +977,7 @@ handle_command(pms_pending_keys action)
 {
 	Message		err;
 	Song *		song = NULL;
+	ListItemSong *	list_item;
 	List *		list = pms->disp->active_list;
 	Songlist *	songlist = dynamic_cast<Songlist *>(list);
 	Songlist *	dlist = NULL;
@@ -1057,8 +1098,9 @@ handle_command(pms_pending_keys action)
 			if (songlist == pms->comm->queue()) {
 				if (action == PEND_PLAYRANDOM)
 				{
-					song = songlist->randsong();
-					pms->comm->playid(song->id);
+					list_item = songlist->randsong();
+					if (list_item == NULL) break;
+					pms->comm->playid(list_item->id);
 					break;
 				}
 				/* Don't add songs from playlist, use library instead */
@@ -1075,17 +1117,19 @@ handle_command(pms_pending_keys action)
 				sn = MPD_SONG_NO_NUM;
 				for (l = 0; l < i; l++)
 				{
-					song = songlist->randsong();
+					list_item = songlist->randsong();
+					if (list_item == NULL) break;
 					if (sn == MPD_SONG_NO_NUM)
-						sn = pms->comm->add(pms->comm->queue(), song);
+						sn = pms->comm->add(pms->comm->queue(), list_item->song);
 					else
-						pms->comm->add(pms->comm->queue(), song);
+						pms->comm->add(pms->comm->queue(), list_item->song);
 				}
 			}
 			else
 			{
-				song = songlist->randsong();
-				sn = pms->comm->add(pms->comm->queue(), song);
+				list_item = songlist->randsong();
+				if (list_item == NULL) break;
+				sn = pms->comm->add(pms->comm->queue(), list_item->song);
 			}
 
 			if (sn == MPD_SONG_NO_NUM)
@@ -1101,8 +1145,8 @@ handle_command(pms_pending_keys action)
 				pms->log(MSG_STATUS, STERR, _("This command can only be run within a playlist."));
 				break;
 			}
-			song = songlist->randsong(&sn);
-			if (song == NULL) break;
+			list_item = songlist->randsong(&sn);
+			if (list_item == NULL) break;
 			pms->disp->active_list->set_cursor(sn);
 			break;
 
@@ -1150,9 +1194,8 @@ handle_command(pms_pending_keys action)
 					break;
 				}
 
-				/* FIXME: ->pos implementation should be moved to ListItem, otherwise this will crash */
 				assert(songlist);
-				list->set_cursor(LISTITEMSONG(item)->song->pos);
+				list->set_cursor(LISTITEMSONG(item)->pos);
 			}
 			break;
 
@@ -1245,10 +1288,9 @@ handle_command(pms_pending_keys action)
 				break;
 			}
 
-			/* FIXME: ->pos implementation should be moved to ListItem, otherwise this will crash */
 			assert(songlist);
 			pms->log(MSG_STATUS, STOK, "/%s", pms->input->searchterm.c_str());
-			list->set_cursor(LISTITEMSONG(item)->song->pos);
+			list->set_cursor(LISTITEMSONG(item)->pos);
 			break;
 
 		case PEND_JUMPMODE:
@@ -1556,13 +1598,13 @@ void		generr()
 int		playnext(int playnow)
 {
 	ListItemSong *	last_item;
-	Song *		song;
+	ListItemSong *	song;
 	int		i;
 
 	last_item = dynamic_cast<ListItemSong *>(pms->comm->queue()->last());
 
 	if (!pms->comm->status()->random) {
-		if (!pms->cursong() || last_item->song->pos != pms->cursong()->pos)
+		if (!pms->cursong() || last_item->pos != pms->cursong_pos())
 			song = pms->comm->queue()->nextsong();
 		else
 			song = pms->comm->activelist()->nextsong();
@@ -1570,11 +1612,11 @@ int		playnext(int playnow)
 		if (!song) return MPD_SONG_NO_ID;
 
 		if (song->id == MPD_SONG_NO_NUM)
-			i = pms->comm->add(pms->comm->queue(), song);
+			i = pms->comm->add(pms->comm->queue(), song->song);
 		else
 			i = song->id;
 	} else {
-		if (pms->cursong() && last_item->song->pos != pms->cursong()->pos)
+		if (pms->cursong() && last_item->pos != pms->cursong_pos())
 		{
 			song = pms->comm->queue()->nextsong();
 			if (!song) return MPD_SONG_NO_ID;
@@ -1584,7 +1626,7 @@ int		playnext(int playnow)
 		{
 			song = pms->comm->activelist()->randsong();
 			if (!song) return MPD_SONG_NO_ID;
-			i = pms->comm->add(pms->comm->queue(), song);
+			i = pms->comm->add(pms->comm->queue(), song->song);
 		}
 	}
 
@@ -1609,6 +1651,8 @@ int		multiplay(long mode, int playmode)
 	Songlist *		list;
 	Song *			song;
 	ListItem *		item;
+	vector<Song *>		songs;
+	vector<bool>		succeeded;
 	int			i = MATCH_FAILED;
 	int			listend;
 	int			first = -1;
@@ -1659,7 +1703,7 @@ int		multiplay(long mode, int playmode)
 					//find position in the library of the playlist's last track, 
 					//start adding from the one after that
 					item = list->match(LISTITEMSONG(playlist->last())->song->file, 0, list->size() - 1, MATCH_FILE | MATCH_EXACT);
-					i = LISTITEMSONG(item)->song->pos + 1;
+					i = LISTITEMSONG(item)->pos + 1;
 					pms->log(MSG_STATUS, STOK, _("%s remainder of album '%s' by %s"), pmode.c_str(), song->album.c_str(), song->artist.c_str());
 				}
 			}
@@ -1675,32 +1719,24 @@ int		multiplay(long mode, int playmode)
 			return false;
 	}
 
-	/* FIXME */
-	//if (!pms->comm->list_start()) {
-		//return false;
-	//}
-
-	while (i < list->size())
-	{
-		item = list->match(pattern, i, list->size() - 1, mode | MATCH_EXACT);
-		if (!item) {
-			break;
-		}
-		assert(LISTITEMSONG(item));
-		i = LISTITEMSONG(item)->song->pos;
-		if (first == -1) {
-			first = playlist->size();
+	/* Collect the matching songs in one pass, and add them in as few
+	 * round trips as possible. */
+	if (mode == MATCH_ALL) {
+		songs.reserve(list->size());
+		for (i = 0; i < (int)list->size(); i++) {
+			songs.push_back(list->song(i));
 		}
-		if (pms->comm->add(playlist, LISTITEMSONG(item)->song) == MPD_SONG_NO_ID) {
+	} else {
+		list->match_all(pattern, i, mode | MATCH_EXACT, songs);
+	}
+
+	if (songs.size() > 0) {
+		first = playlist->size();
+		if (pms->comm->add(playlist, songs, succeeded) == MPD_SONG_NO_ID) {
 			return false;
 		}
-		++i;
 	}
 
-	//if (!pms->comm->list_end()) {
-		//return false;
-	//}
-
 	if (first != -1 && playmode == 0) {
 		pms->comm->playpos(first);
 	}
@@ -1795,6 +1831,7 @@ bool init_commandmap()
 	pms->commands->add("!", "Run a shell command", PEND_SHELL);
 	pms->commands->add("command-mode", "Switch to command mode", PEND_COMMANDMODE);
 	pms->commands->add("info", "Show file information in console", PEND_SHOW_INFO);
+	pms->commands->add("memstats", "Show memory usage of song metadata", PEND_MEMSTATS);
 	pms->commands->add("password", "Send a password to the server", PEND_PASSWORD);
 	pms->commands->add("source", "Read a script or configuration file", PEND_SOURCE);
 	pms->commands->add("rehash", "Read configuration file", PEND_REHASH);
@@ -58,6 +58,7 @@ public:
 	long			quit();
 	long			shell(string);
 	long			show_info();
+	long			show_memstats();
 	void			clear_filters();
 	int			set_input_mode(Input_mode);
 
@@ -0,0 +1,302 @@
+/* vi:set ts=8 sts=8 sw=8 noet:
+ *
+ * PMS	<<Practical Music Search>>
+ * Copyright (C) 2006-2015  Kim Tore Jensen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * async.cpp
+ * 	non-blocking MPD connection driven by the main loop
+ */
+
+
+#include <assert.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "async.h"
+#include "pms.h"
+
+extern Pms *	pms;
+
+
+Asyncclient::Asyncclient(const string & n_host, long n_port, long n_timeout_ms)
+{
+	host = n_host;
+	port = static_cast<unsigned int>(n_port);
+	timeout_ms = static_cast<unsigned int>(n_timeout_ms);
+	async = NULL;
+	parser = NULL;
+}
+
+Asyncclient::~Asyncclient()
+{
+	disconnect();
+}
+
+bool
+Asyncclient::connect(const string & password)
+{
+	struct mpd_connection *	c;
+	int			fd = -1;
+
+	disconnect();
+
+	pms->log(MSG_DEBUG, 0, "Opening asynchronous connection to %s:%d\n", host.c_str(), port);
+
+	if ((c = mpd_connection_new(host.c_str(), port, timeout_ms)) == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		abort();
+	}
+
+	/* Let libmpdclient resolve the host, read the greeting and send the
+	 * password, and take over the socket afterwards. */
+	if (mpd_connection_get_error(c) == MPD_ERROR_SUCCESS
+			&& (password.size() == 0 || mpd_run_password(c, password.c_str()))) {
+		if ((fd = dup(mpd_connection_get_fd(c))) == -1) {
+			error_ = strerror(errno);
+		}
+	} else {
+		error_ = mpd_connection_get_error_message(c);
+	}
+
+	mpd_connection_free(c);
+
+	if (fd == -1) {
+		pms->log(MSG_DEBUG, 0, "Asynchronous connection failed: %s\n", error_.c_str());
+		return false;
+	}
+
+	if ((async = mpd_async_new(fd)) == NULL || (parser = mpd_parser_new()) == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		abort();
+	}
+
+	error_.clear();
+
+	return true;
+}
+
+void
+Asyncclient::disconnect()
+{
+	deque<handler>		failed;
+
+	if (async == NULL) {
+		return;
+	}
+
+	pms->log(MSG_DEBUG, 0, "Closing asynchronous connection, %d commands unanswered\n", pending.size());
+
+	mpd_parser_free(parser);
+	mpd_async_free(async);
+	parser = NULL;
+	async = NULL;
+	pairs.clear();
+
+	/* Handlers may queue new commands */
+	failed.swap(pending);
+	while (failed.size()) {
+		if (failed.front()) {
+			failed.front()(false, pairs, error_.size() ? error_ : "Connection closed");
+		}
+		failed.pop_front();
+	}
+}
+
+bool
+Asyncclient::send(handler done, const char * command, ...)
+{
+	va_list		args;
+	va_list		copy;
+	bool		queued;
+	short		revents;
+
+	if (async == NULL) {
+		return false;
+	}
+
+	va_start(args, command);
+
+	/* The output buffer is only full if MPD has stopped reading, so it
+	 * is acceptable to wait for it in that case. */
+	while (true) {
+		va_copy(copy, args);
+		queued = mpd_async_send_command_v(async, command, copy);
+		va_end(copy);
+
+		if (queued || mpd_async_get_error(async) != MPD_ERROR_SUCCESS) {
+			break;
+		}
+		revents = wait(true, timeout_ms);
+		if (!revents || !run(revents & POLLIN, revents & POLLOUT)) {
+			break;
+		}
+	}
+
+	va_end(args);
+
+	if (!queued) {
+		if (async != NULL) {
+			fail(mpd_async_get_error_message(async) ? mpd_async_get_error_message(async) : "Timeout");
+		}
+		return false;
+	}
+
+	pending.push_back(done);
+
+	return true;
+}
+
+int
+Asyncclient::get_file_descriptor()
+{
+	return (async ? mpd_async_get_fd(async) : -1);
+}
+
+bool
+Asyncclient::wants_write()
+{
+	return (async && (mpd_async_events(async) & MPD_ASYNC_EVENT_WRITE));
+}
+
+bool
+Asyncclient::run(bool readable, bool writable)
+{
+	int		events = 0;
+	char *		line;
+
+	if (async == NULL) {
+		return false;
+	}
+
+	if (readable) {
+		events |= MPD_ASYNC_EVENT_READ;
+	}
+	if (writable) {
+		events |= MPD_ASYNC_EVENT_WRITE;
+	}
+
+	if (events && !mpd_async_io(async, static_cast<enum mpd_async_event>(events))) {
+		return fail(mpd_async_get_error_message(async));
+	}
+
+	while ((line = mpd_async_recv_line(async)) != NULL) {
+		switch (mpd_parser_feed(parser, line)) {
+			case MPD_PARSER_PAIR:
+				pairs.push_back(make_pair(mpd_parser_get_name(parser), mpd_parser_get_value(parser)));
+				break;
+			case MPD_PARSER_SUCCESS:
+				dispatch(true, "");
+				break;
+			case MPD_PARSER_ERROR:
+				dispatch(false, mpd_parser_get_message(parser));
+				break;
+			case MPD_PARSER_MALFORMED:
+			default:
+				return fail("Malformed response from MPD");
+		}
+
+		/* A handler may have closed the connection */
+		if (async == NULL) {
+			return false;
+		}
+	}
+
+	if (mpd_async_get_error(async) != MPD_ERROR_SUCCESS) {
+		return fail(mpd_async_get_error_message(async));
+	}
+
+	return true;
+}
+
+bool
+Asyncclient::drain(long timeout)
+{
+	short	revents;
+
+	while (async && pending.size()) {
+		revents = wait(wants_write(), timeout);
+		if (!revents) {
+			return fail("Timeout");
+		}
+		if (!run(revents & POLLIN, revents & POLLOUT)) {
+			return false;
+		}
+	}
+
+	return (async != NULL);
+}
+
+/*
+ * Wait until the socket is readable, or writable if asked for. Returns the
+ * events which occurred, or zero on timeout. An error or hangup is reported
+ * as readable, so that the following read picks it up.
+ */
+short
+Asyncclient::wait(bool writable, long timeout)
+{
+	struct pollfd	p;
+
+	p.fd = mpd_async_get_fd(async);
+	p.events = POLLIN | (writable ? POLLOUT : 0);
+	p.revents = 0;
+
+	if (poll(&p, 1, timeout) <= 0) {
+		return 0;
+	}
+
+	if (p.revents & (POLLERR | POLLHUP | POLLNVAL)) {
+		p.revents |= POLLIN;
+	}
+
+	return (p.revents & (POLLIN | POLLOUT));
+}
+
+void
+Asyncclient::dispatch(bool ok, const string & error)
+{
+	handler		done;
+
+	if (!pending.size()) {
+		pms->log(MSG_DEBUG, 0, "Unexpected response from MPD on asynchronous connection\n");
+		pairs.clear();
+		return;
+	}
+
+	done = pending.front();
+	pending.pop_front();
+
+	if (done) {
+		done(ok, pairs, error);
+	}
+
+	pairs.clear();
+}
+
+bool
+Asyncclient::fail(const string & error)
+{
+	error_ = error;
+	pms->log(MSG_DEBUG, 0, "Asynchronous connection failed: %s\n", error_.c_str());
+	disconnect();
+
+	return false;
+}
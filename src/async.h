@@ -0,0 +1,140 @@
+/* vi:set ts=8 sts=8 sw=8 noet:
+ *
+ * PMS	<<Practical Music Search>>
+ * Copyright (C) 2006-2015  Kim Tore Jensen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * async.h
+ * 	non-blocking MPD connection driven by the main loop
+ */
+
+
+#ifndef _PMS_ASYNC_H_
+#define _PMS_ASYNC_H_
+
+#include <deque>
+#include <functional>
+#include <string>
+#include <vector>
+#include <mpd/client.h>
+
+using namespace std;
+
+
+/**
+ * A connection to MPD which never blocks the caller. Commands are queued in
+ * libmpdclient's output buffer together with a function that receives their
+ * response. The main loop polls the socket, calls run() when it is ready,
+ * and the responses are dispatched in the order the commands were sent.
+ *
+ * Only establishing the connection blocks, in the same way as the main
+ * connection does.
+ */
+class Asyncclient
+{
+public:
+	typedef vector<pair<string, string> >	response;
+
+	/**
+	 * Receives the name/value pairs of a response when 'ok' is true, or
+	 * the error message from MPD when 'ok' is false.
+	 */
+	typedef function<void(bool ok, const response & pairs, const string & error)>	handler;
+
+private:
+	string				host;
+	unsigned int			port;
+	unsigned int			timeout_ms;
+
+	struct mpd_async *		async;
+	struct mpd_parser *		parser;
+
+	/* Commands waiting for a response, oldest first */
+	deque<handler>			pending;
+	response			pairs;
+	string				error_;
+
+	short				wait(bool writable, long timeout);
+	void				dispatch(bool ok, const string & error);
+	bool				fail(const string & error);
+
+public:
+					Asyncclient(const string & host, long port, long timeout_ms);
+					~Asyncclient();
+
+	/**
+	 * Connect to MPD, and send the password if one is given.
+	 *
+	 * Returns true on success, false on failure.
+	 */
+	bool				connect(const string & password);
+
+	/**
+	 * Close the connection. Commands waiting for a response fail.
+	 */
+	void				disconnect();
+
+	bool				connected() const { return async != NULL; };
+
+	/**
+	 * Queue a command. The arguments are strings, terminated by NULL.
+	 * 'done' is called from run() when the response arrives, and may be
+	 * empty.
+	 *
+	 * Returns true if the command was queued, false otherwise.
+	 */
+	bool				send(handler done, const char * command, ...);
+
+	/**
+	 * Number of commands waiting for a response.
+	 */
+	size_t				size() const { return pending.size(); };
+
+	/**
+	 * Socket to poll for reading, or -1 if not connected. Must only be
+	 * used for polling!
+	 */
+	int				get_file_descriptor();
+
+	/**
+	 * True if there is queued output, and the socket should be polled
+	 * for writing as well.
+	 */
+	bool				wants_write();
+
+	/**
+	 * Write queued commands and read responses, as far as possible
+	 * without blocking, and dispatch every complete response.
+	 *
+	 * Returns false if the connection failed.
+	 */
+	bool				run(bool readable, bool writable);
+
+	/**
+	 * Block until every queued command has been answered, or until no
+	 * progress has been made for 'timeout_ms' milliseconds.
+	 *
+	 * Returns false on timeout or connection failure.
+	 */
+	bool				drain(long timeout_ms);
+
+	/**
+	 * Message from the last connection failure.
+	 */
+	const string &			error() const { return error_; };
+};
+
+#endif /* _PMS_ASYNC_H_ */
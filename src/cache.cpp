@@ -0,0 +1,353 @@
+/* vi:set ts=8 sts=8 sw=8 noet:
+ *
+ * PMS	<<Practical Music Search>>
+ * Copyright (C) 2006-2015  Kim Tore Jensen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * cache.cpp
+ * 	binary on-disk copy of the song library
+ */
+
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+#include "cache.h"
+#include "songlist.h"
+#include "song.h"
+#include "pms.h"
+
+extern Pms *			pms;
+
+#define CACHE_MAGIC		0x50534d4c	/* "LMSP" on little-endian */
+#define CACHE_VERSION		1
+
+/*
+ * Tags stored in each record, in file order. Derived tags such as the year
+ * and the short track number are rebuilt by Song::init() when loading.
+ */
+static Tag Song::* const	cache_tags[] = {
+	&Song::file,
+	&Song::artist,
+	&Song::albumartist,
+	&Song::albumartistsort,
+	&Song::artistsort,
+	&Song::title,
+	&Song::album,
+	&Song::track,
+	&Song::name,
+	&Song::date,
+	&Song::genre,
+	&Song::composer,
+	&Song::performer,
+	&Song::disc,
+	&Song::comment
+};
+
+#define CACHE_TAGS		(sizeof(cache_tags) / sizeof(cache_tags[0]))
+
+struct cache_header
+{
+	uint32_t		magic;
+	uint32_t		version;
+	uint32_t		record_size;
+	uint32_t		string_count;
+	uint32_t		string_bytes;
+	uint32_t		song_count;
+	uint64_t		db_update_time;
+};
+
+struct cache_record
+{
+	uint32_t		tags[CACHE_TAGS];
+	int32_t			time;
+	int64_t			last_modified;
+};
+
+/*
+ * Create a directory and all its parents.
+ */
+static bool
+make_directory(const string & path)
+{
+	size_t			pos = 0;
+
+	while ((pos = path.find('/', pos + 1)) != string::npos) {
+		if (mkdir(path.substr(0, pos).c_str(), 0755) != 0 && errno != EEXIST) {
+			return false;
+		}
+	}
+
+	return (mkdir(path.c_str(), 0755) == 0 || errno == EEXIST);
+}
+
+Librarycache::Librarycache(const string & host, long port)
+{
+	char *			xdgcachehome;
+	char *			homedir;
+	string			dir;
+	string			name;
+	string::iterator	iter;
+
+	xdgcachehome = getenv("XDG_CACHE_HOME");
+	homedir = getenv("HOME");
+
+	if (xdgcachehome != NULL && strlen(xdgcachehome) > 0) {
+		dir = xdgcachehome;
+	} else if (homedir != NULL && strlen(homedir) > 0) {
+		dir = homedir;
+		dir += "/.cache";
+	} else {
+		dir = "/tmp";
+	}
+
+	/* Socket paths contain slashes */
+	name = host;
+	for (iter = name.begin(); iter != name.end(); ++iter) {
+		if (*iter == '/') {
+			*iter = '_';
+		}
+	}
+
+	path_ = dir + "/pms/" + name + "-" + Pms::tostring(port) + ".db";
+}
+
+bool
+Librarycache::load(Songlist * list, unsigned long * db_update_time)
+{
+	int				fd;
+	struct stat			st;
+	void *				map;
+	const char *			data;
+	const cache_header *		header;
+	const uint32_t *		offsets;
+	const char *			strings;
+	const cache_record *		records;
+	size_t				expected;
+	vector<string>			table;
+	uint32_t			i;
+	uint32_t			t;
+	Song *				song;
+	bool				valid;
+
+	assert(list != NULL);
+	assert(db_update_time != NULL);
+
+	if ((fd = open(path_.c_str(), O_RDONLY)) == -1) {
+		return false;
+	}
+
+	if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(cache_header)) {
+		close(fd);
+		return false;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		return false;
+	}
+
+	data = static_cast<const char *>(map);
+	header = reinterpret_cast<const cache_header *>(data);
+
+	valid = (header->magic == CACHE_MAGIC &&
+		 header->version == CACHE_VERSION &&
+		 header->record_size == sizeof(cache_record) &&
+		 header->string_count > 0);
+
+	if (valid) {
+		expected = sizeof(cache_header)
+			 + (size_t)(header->string_count + 1) * sizeof(uint32_t)
+			 + header->string_bytes;
+		expected = (expected + 7) & ~(size_t)7;
+		valid = (expected + (size_t)header->song_count * sizeof(cache_record) == (size_t)st.st_size);
+	}
+
+	if (!valid) {
+		pms->log(MSG_DEBUG, 0, "Ignoring invalid library cache %s\n", path_.c_str());
+		munmap(map, st.st_size);
+		return false;
+	}
+
+	offsets = reinterpret_cast<const uint32_t *>(data + sizeof(cache_header));
+	strings = reinterpret_cast<const char *>(offsets + header->string_count + 1);
+	records = reinterpret_cast<const cache_record *>(data + expected);
+
+	/* Check the string table before creating any songs */
+	table.reserve(header->string_count);
+	for (i = 0; i < header->string_count; i++) {
+		if (offsets[i] > offsets[i + 1] || offsets[i + 1] > header->string_bytes) {
+			valid = false;
+			break;
+		}
+		table.push_back(string(strings + offsets[i], offsets[i + 1] - offsets[i]));
+	}
+	for (i = 0; valid && i < header->song_count; i++) {
+		for (t = 0; t < CACHE_TAGS; t++) {
+			if (records[i].tags[t] >= header->string_count) {
+				valid = false;
+				break;
+			}
+		}
+	}
+
+	if (!valid) {
+		pms->log(MSG_DEBUG, 0, "Ignoring corrupt library cache %s\n", path_.c_str());
+		munmap(map, st.st_size);
+		return false;
+	}
+
+	for (i = 0; i < header->song_count; i++) {
+		song = Song::acquire(table[records[i].tags[0]]);
+
+		/* Songs already known, e.g. from the queue, were read from
+		 * MPD and are at least as fresh as the cache. */
+		if (song->last_modified == 0) {
+			for (t = 1; t < CACHE_TAGS; t++) {
+				song->*cache_tags[t] = table[records[i].tags[t]];
+			}
+			song->time = records[i].time;
+			song->last_modified = records[i].last_modified;
+			song->init();
+		}
+
+		list->add_local(song);
+	}
+
+	*db_update_time = header->db_update_time;
+
+	pms->log(MSG_DEBUG, 0, "Loaded %u songs and %u strings from library cache %s\n",
+			header->song_count, header->string_count, path_.c_str());
+
+	munmap(map, st.st_size);
+
+	return true;
+}
+
+bool
+Librarycache::save(Songlist * list, unsigned long db_update_time)
+{
+	typedef unordered_map<Tag, uint32_t, TagHash>	stringmap;
+
+	stringmap			indexes;
+	stringmap::iterator		index;
+	vector<Tag>			table;
+	vector<uint32_t>		offsets;
+	vector<cache_record>		records;
+	cache_header			header;
+	string				tmppath;
+	string::size_type		slash;
+	uint32_t			bytes = 0;
+	uint32_t			i;
+	uint32_t			t;
+	Song *				song;
+	FILE *				fp;
+	bool				ok;
+	static const char		padding[8] = { 0 };
+	size_t				pad;
+
+	assert(list != NULL);
+
+	slash = path_.rfind('/');
+	if (slash == string::npos || !make_directory(path_.substr(0, slash))) {
+		pms->log(MSG_DEBUG, 0, "Could not create directory for library cache %s: %s\n", path_.c_str(), strerror(errno));
+		return false;
+	}
+
+	/* The empty string always has index zero */
+	table.push_back(Tag());
+	offsets.push_back(0);
+	offsets.push_back(0);
+	indexes[Tag()] = 0;
+
+	records.resize(list->size());
+	if (!records.empty()) {
+		memset(&records[0], 0, records.size() * sizeof(cache_record));
+	}
+
+	for (i = 0; i < list->size(); i++) {
+		song = list->song(i);
+		for (t = 0; t < CACHE_TAGS; t++) {
+			const Tag & tag = song->*cache_tags[t];
+			index = indexes.find(tag);
+			if (index == indexes.end()) {
+				index = indexes.insert(stringmap::value_type(tag, table.size())).first;
+				table.push_back(tag);
+				bytes += tag.size();
+				offsets.push_back(bytes);
+			}
+			records[i].tags[t] = index->second;
+		}
+		records[i].time = song->time;
+		records[i].last_modified = song->last_modified;
+	}
+
+	header.magic = CACHE_MAGIC;
+	header.version = CACHE_VERSION;
+	header.record_size = sizeof(cache_record);
+	header.string_count = table.size();
+	header.string_bytes = bytes;
+	header.song_count = records.size();
+	header.db_update_time = db_update_time;
+
+	/* Write to a temporary file and move it into place, so that a crash
+	 * never leaves a half-written cache behind. */
+	tmppath = path_ + ".tmp";
+	if ((fp = fopen(tmppath.c_str(), "wb")) == NULL) {
+		pms->log(MSG_DEBUG, 0, "Could not write library cache %s: %s\n", tmppath.c_str(), strerror(errno));
+		return false;
+	}
+
+	ok = (fwrite(&header, sizeof(header), 1, fp) == 1);
+	ok = ok && (fwrite(&offsets[0], sizeof(uint32_t), offsets.size(), fp) == offsets.size());
+	for (i = 0; ok && i < table.size(); i++) {
+		ok = (fwrite(table[i].c_str(), 1, table[i].size(), fp) == table[i].size());
+	}
+
+	/* Align records to eight bytes, so they can be read in place */
+	pad = (sizeof(header) + offsets.size() * sizeof(uint32_t) + bytes) & 7;
+	if (ok && pad) {
+		ok = (fwrite(padding, 1, 8 - pad, fp) == 8 - pad);
+	}
+
+	if (ok && !records.empty()) {
+		ok = (fwrite(&records[0], sizeof(cache_record), records.size(), fp) == records.size());
+	}
+
+	ok = (fclose(fp) == 0) && ok;
+
+	if (!ok || rename(tmppath.c_str(), path_.c_str()) != 0) {
+		pms->log(MSG_DEBUG, 0, "Could not write library cache %s: %s\n", path_.c_str(), strerror(errno));
+		unlink(tmppath.c_str());
+		return false;
+	}
+
+	pms->log(MSG_DEBUG, 0, "Saved %u songs and %u strings to library cache %s\n",
+			header.song_count, header.string_count, path_.c_str());
+
+	return true;
+}
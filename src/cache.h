@@ -0,0 +1,78 @@
+/* vi:set ts=8 sts=8 sw=8 noet:
+ *
+ * PMS	<<Practical Music Search>>
+ * Copyright (C) 2006-2015  Kim Tore Jensen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * cache.h
+ * 	binary on-disk copy of the song library
+ */
+
+
+#ifndef _PMS_CACHE_H_
+#define _PMS_CACHE_H_
+
+#include <string>
+
+using namespace std;
+
+class Songlist;
+
+
+/**
+ * Binary copy of the song library, stored between sessions so that the
+ * library is available at startup without downloading it from MPD.
+ *
+ * The file consists of a header, a string table holding every distinct tag
+ * value once, and one fixed-size record per song which refers to strings by
+ * their index in the table. Records are stored in list order, so a library
+ * saved after sorting loads pre-sorted.
+ *
+ * There is one cache file per server, named after the host and port. The
+ * MPD database update time is stored in the header, and decides whether
+ * the cached copy is still current.
+ */
+class Librarycache
+{
+private:
+	string			path_;
+
+public:
+				Librarycache(const string & host, long port);
+
+	/**
+	 * Full path of the cache file.
+	 */
+	const string &		path() const { return path_; };
+
+	/**
+	 * Append the cached songs to a list, and return the database update
+	 * time they were saved with.
+	 *
+	 * Returns true on success, false if the cache is missing or invalid,
+	 * in which case the list is left untouched.
+	 */
+	bool			load(Songlist * list, unsigned long * db_update_time);
+
+	/**
+	 * Replace the cache with the contents of a list.
+	 *
+	 * Returns true on success, false on failure.
+	 */
+	bool			save(Songlist * list, unsigned long db_update_time);
+};
+
+#endif /* _PMS_CACHE_H_ */
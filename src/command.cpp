@@ -23,9 +23,12 @@
 
 #include <unistd.h>
 #include <math.h>
+#include <algorithm>
+#include <unordered_map>
 #include <mpd/client.h>
 
 #include "command.h"
+#include "cache.h"
 #include "queue.h"
 #include "library.h"
 #include "pms.h"
@@ -34,7 +37,8 @@ extern Pms *			pms;
 
 #define EXIT_IDLE		if (!exit_idle()) { return false; }
 
-#define NOIDLE_POLL_TIMEOUT	20  /* time to wait for zmq_poll() to finish after calling noidle() */
+#define LIBRARY_CHUNK_SIZE	2000  /* entities received per main loop iteration while loading the library */
+#define PLAYLIST_TAIL_OVERLAP	16    /* entries before the old end of a stored playlist which are downloaded again to detect appends */
 
 
 /*
@@ -72,6 +76,7 @@ Mpd_status::Mpd_status()
 	songs_count		= 0;
 
 	uptime			= 0;
+	uptime_sampled		= 0;
 	db_update_time		= 0;
 	playtime		= 0;
 	db_playtime		= 0;
@@ -131,6 +136,7 @@ Mpd_status::assign_stats(struct mpd_stats * stats)
 	songs_count		= mpd_stats_get_number_of_songs(stats);
 
 	uptime			= mpd_stats_get_uptime(stats);
+	uptime_sampled		= time(NULL);
 	db_update_time		= mpd_stats_get_db_update_time(stats);
 	playtime		= mpd_stats_get_play_time(stats);
 	db_playtime		= mpd_stats_get_db_play_time(stats);
@@ -181,12 +187,21 @@ Control::Control(Connection * n_conn)
 	st = new Mpd_status();
 	rootdir = new Directory(NULL, "");
 	_song = NULL;
+	_song_pos = MPD_SONG_NO_NUM;
+	_song_id = MPD_SONG_NO_ID;
 	st->last_playlist = -1;
 	_queue = new Queue;
 	_library = new Library;
 	_active = NULL;
-	_is_idle = false;
-	command_mode = 0;
+	_library_loading = false;
+	_library_progressive = false;
+	_library_received = 0;
+	_library_db_update_time = 0;
+	_library_cache_time = 0;
+	_library_dir = rootdir;
+	_fetcher = NULL;
+	_async = new Asyncclient(pms->options->host, pms->options->port, pms->options->mpd_timeout * 1000);
+	_listener = new Asyncclient(pms->options->host, pms->options->port, pms->options->mpd_timeout * 1000);
 	mutevolume = 0;
 	crossfadetime = pms->options->crossfade;
 
@@ -203,6 +218,10 @@ Control::~Control()
 	delete _library;
 	delete _queue;
 	*/
+	delete _fetcher;
+	delete _async;
+	delete _listener;
+	delete rootdir;
 	delete st;
 }
 
@@ -288,7 +307,29 @@ Control::get_error_bool()
 bool
 Control::exit_idle()
 {
-	return (!(is_idle() && (!noidle() || !wait_until_noidle())));
+	/* The connection is busy until the library download is complete */
+	if (connection_busy() && !receive_library(0)) {
+		return false;
+	}
+
+	/* Commands on the main connection must see the effect of commands
+	 * already sent on the asynchronous one. A failure there is reported
+	 * by its own handlers. */
+	if (_async->size()) {
+		_async->drain(pms->options->mpd_timeout * 1000);
+	}
+
+	/* MPD closes connections which have been quiet for longer than its
+	 * connection_timeout. Nothing was missed in the meantime, since
+	 * changes are reported on the IDLE connection. */
+	if (conn->stale()) {
+		pms->log(MSG_DEBUG, 0, "Command connection was closed by MPD, reconnecting.\n");
+		if (!reconnect()) {
+			return false;
+		}
+	}
+
+	return true;
 }
 
 /**
@@ -330,6 +371,11 @@ Control::set_mpd_idle_events(enum mpd_idle idle_reply)
 bool
 Control::has_pending_updates()
 {
+	/* A library download in the background does not hold up anything */
+	if (_fetcher) {
+		return ((idle_events & ~MPD_IDLE_DATABASE) != 0);
+	}
+
 	return (idle_events != 0);
 }
 
@@ -341,23 +387,23 @@ Control::has_pending_updates()
 bool
 Control::run_pending_updates()
 {
-	/* MPD has new current song */
-	if (idle_events & MPD_IDLE_PLAYER) {
-		if (!get_current_song()) {
-			return false;
-		}
-		/* MPD_IDLE_PLAYER will be subtracted below */
-	}
+	uint32_t	events;
+
+	/* A library download in progress keeps the database event pending,
+	 * but the statistics were already retrieved when it started. */
+	events = idle_events & ~(_library_loading ? MPD_IDLE_DATABASE : 0);
 
-	/* MPD has new status information */
-	if (idle_events & (MPD_IDLE_PLAYER | MPD_IDLE_MIXER | MPD_IDLE_OPTIONS | MPD_IDLE_QUEUE)) {
-		if (!get_status()) {
+	/* MPD has new status information. The current song only changes
+	 * with the player, and the statistics only with the database. */
+	if (events & (MPD_IDLE_PLAYER | MPD_IDLE_MIXER | MPD_IDLE_OPTIONS | MPD_IDLE_QUEUE | MPD_IDLE_DATABASE | MPD_IDLE_UPDATE)) {
+		if (!refresh_status(events & MPD_IDLE_PLAYER, events & (MPD_IDLE_DATABASE | MPD_IDLE_UPDATE))) {
 			return false;
 		}
 		set_update_done(MPD_IDLE_PLAYER);
 		set_update_done(MPD_IDLE_MIXER);
 		set_update_done(MPD_IDLE_OPTIONS);
-		/* MPD_IDLE_QUEUE will be subtracted below */
+		set_update_done(MPD_IDLE_UPDATE);
+		/* MPD_IDLE_QUEUE and MPD_IDLE_DATABASE will be subtracted below */
 	}
 
 	/* MPD has updates to queue */
@@ -384,13 +430,16 @@ Control::run_pending_updates()
 		if (!update_library()) {
 			return false;
 		}
-		set_update_done(MPD_IDLE_DATABASE);
+		if (!_library_loading) {
+			set_update_done(MPD_IDLE_DATABASE);
+		}
 	}
 
 	/* Hack to make has_pending_updates() work smoothly without too much
 	 * effort. We don't care about the rest of the events, so we just
-	 * pretend they never happened. */
-	idle_events = 0;
+	 * pretend they never happened. A library download in progress stays
+	 * pending until it is complete. */
+	idle_events &= (_library_loading ? MPD_IDLE_DATABASE : 0);
 
 	return true;
 }
@@ -614,46 +663,108 @@ Control::get_available_commands()
 	return get_error_bool();
 }
 
+/*
+ * Response handler for asynchronous commands which return nothing.
+ */
+static void
+async_result(bool ok, const Asyncclient::response & pairs, const string & error)
+{
+	if (!ok) {
+		pms->log(MSG_STATUS, STERR, "MPD error: %s", error.c_str());
+	}
+}
+
+/*
+ * Make sure the asynchronous connection is up, connecting if needed.
+ *
+ * Returns true if commands can be sent, false otherwise.
+ */
+bool
+Control::async_ready()
+{
+	if (_async->connected()) {
+		return true;
+	}
+
+	if (!_async->connect(pms->options->password)) {
+		pms->log(MSG_STATUS, STERR, "MPD error: %s", _async->error().c_str());
+		return false;
+	}
+
+	return true;
+}
+
+int
+Control::get_async_file_descriptor()
+{
+	return _async->get_file_descriptor();
+}
+
+bool
+Control::async_wants_write()
+{
+	return _async->wants_write();
+}
+
+bool
+Control::run_async(bool readable, bool writable)
+{
+	if (!_async->connected()) {
+		return false;
+	}
+
+	return _async->run(readable, writable);
+}
+
+/*
+ * Drop the asynchronous and IDLE connections, and reconnect with the
+ * current connection settings when they are next needed.
+ */
+void
+Control::reset_async()
+{
+	delete _async;
+	delete _listener;
+	_async = new Asyncclient(pms->options->host, pms->options->port, pms->options->mpd_timeout * 1000);
+	_listener = new Asyncclient(pms->options->host, pms->options->port, pms->options->mpd_timeout * 1000);
+}
+
 /*
  * Play, pause, toggle, stop, next, prev
+ *
+ * These, and the other player controls below, are sent on the asynchronous
+ * connection, so that a keypress never waits for MPD. The new state arrives
+ * through IDLE. Errors are shown when the response comes in.
  */
 bool
 Control::play()
 {
-	EXIT_IDLE;
-
-	return mpd_run_play(conn->h());
+	return (async_ready() && _async->send(async_result, "play", NULL));
 }
 
 bool
 Control::playid(song_t songid)
 {
-	EXIT_IDLE;
-
-	return mpd_run_play_id(conn->h(), songid);
+	return (async_ready() && _async->send(async_result, "playid", Pms::tostring(songid).c_str(), NULL));
 }
 
 bool
 Control::playpos(song_t songpos)
 {
-	EXIT_IDLE;
-
-	return mpd_run_play_pos(conn->h(), songpos);
+	return (async_ready() && _async->send(async_result, "play", Pms::tostring(songpos).c_str(), NULL));
 }
 
 bool
 Control::pause(bool tryplay)
 {
-	EXIT_IDLE;
-
 	pms->log(MSG_DEBUG, 0, "Toggling pause, tryplay=%d\n", tryplay);
 
 	switch(st->state)
 	{
 		case MPD_STATE_PLAY:
-			return mpd_run_pause(conn->h(), true);
+			return (async_ready() && _async->send(async_result, "pause", "1", NULL));
 		case MPD_STATE_PAUSE:
-			return mpd_run_pause(conn->h(), false);
+			return (async_ready() && _async->send(async_result, "pause", "0", NULL));
 		case MPD_STATE_STOP:
 		case MPD_STATE_UNKNOWN:
 		default:
@@ -664,11 +775,9 @@ Control::pause(bool tryplay)
 bool
 Control::stop()
 {
-	EXIT_IDLE;
-
 	pms->log(MSG_DEBUG, 0, "Stopping playback.\n");
 
-	return mpd_run_stop(conn->h());
+	return (async_ready() && _async->send(async_result, "stop", NULL));
 }
 
 /*
@@ -677,11 +786,9 @@ Control::stop()
 bool
 Control::shuffle()
 {
-	EXIT_IDLE;
-
 	pms->log(MSG_DEBUG, 0, "Shuffling playlist.\n");
 
-	return mpd_run_shuffle(conn->h());
+	return (async_ready() && _async->send(async_result, "shuffle", NULL));
 }
 
 /*
@@ -690,11 +797,9 @@ Control::shuffle()
 bool
 Control::repeat(bool on)
 {
-	EXIT_IDLE;
-
 	pms->log(MSG_DEBUG, 0, "Set repeat to %d\n", on);
 
-	return mpd_run_repeat(conn->h(), on);
+	return (async_ready() && _async->send(async_result, "repeat", (on ? "1" : "0"), NULL));
 }
 
 /*
@@ -703,11 +808,9 @@ Control::repeat(bool on)
 bool
 Control::single(bool on)
 {
-	EXIT_IDLE;
-
 	pms->log(MSG_DEBUG, 0, "Set single to %d\n", on);
 
-	return mpd_run_single(conn->h(), on);
+	return (async_ready() && _async->send(async_result, "single", (on ? "1" : "0"), NULL));
 }
 
 /*
@@ -716,11 +819,9 @@ Control::single(bool on)
 bool
 Control::consume(bool on)
 {
-	EXIT_IDLE;
-
 	pms->log(MSG_DEBUG, 0, "Set consume to %d\n", on);
 
-	return mpd_run_consume(conn->h(), on);
+	return (async_ready() && _async->send(async_result, "consume", (on ? "1" : "0"), NULL));
 }
 
 /*
@@ -737,11 +838,9 @@ Control::setvolume(int vol)
 		vol = 100;
 	}
 
-	EXIT_IDLE;
-
 	pms->log(MSG_DEBUG, 0, "Setting volume to %d%%\n", vol);
 
-	return mpd_run_set_volume(conn->h(), vol);
+	return (async_ready() && _async->send(async_result, "setvol", Pms::tostring(vol).c_str(), NULL));
 }
 
 /*
@@ -787,15 +886,13 @@ Control::muted()
 bool
 Control::random(int set)
 {
-	EXIT_IDLE;
-
 	pms->log(MSG_DEBUG, 0, "Set random to %d\n", set);
 
 	if (set == -1) {
 		set = (st->random == false ? true : false);
 	}
 
-	return mpd_run_random(conn->h(), set);
+	return (async_ready() && _async->send(async_result, "random", (set ? "1" : "0"), NULL));
 }
 
 /*
@@ -803,25 +900,155 @@ Control::random(int set)
  */
 song_t		Control::add(Songlist * source, Songlist * dest)
 {
-	song_t			first = MPD_SONG_NO_ID;
-	song_t			result;
+	vector<Song *>		songs;
+	vector<bool>		succeeded;
 	unsigned int		i;
 
 	assert(source != NULL);
 	assert(dest != NULL);
 
-	for (i = 0; i < source->size(); i++)
-	{
-		result = add(dest, source->song(i));
-		if (result == MPD_SONG_NO_ID) {
-			return result;
+	songs.reserve(source->size());
+	for (i = 0; i < source->size(); i++) {
+		songs.push_back(source->song(i));
+	}
+
+	return add(dest, songs, succeeded);
+}
+
+/*
+ * Add many songs to a list, using command lists.
+ *
+ * Returns the queue id of the first song added to the queue, a non-negative
+ * number if songs were added to a stored playlist, or MPD_SONG_NO_ID if
+ * nothing was added. 'succeeded' tells which of the songs were added.
+ */
+song_t
+Control::add(Songlist * list, const vector<Song *> & songs, vector<bool> & succeeded)
+{
+	vector<song_t>		ids;
+	const char *		filename;
+	uint32_t		i;
+
+	assert(list != NULL);
+
+	succeeded.assign(songs.size(), false);
+
+	if (list == _library || (list != _queue && list->filename.size() == 0)) {
+		return MPD_SONG_NO_ID;
+	}
+
+	pms->log(MSG_DEBUG, 0, "Adding %u songs to list %s\n", songs.size(), list->title());
+
+	filename = list->filename.c_str();
+	ids.resize(songs.size(), MPD_SONG_NO_ID);
+
+	if (list == _queue) {
+		run_command_lists(songs.size(),
+			[&](uint32_t n) {
+				return mpd_send_add_id(conn->h(), songs[n]->file.c_str());
+			},
+			[&](uint32_t n) {
+				ids[n] = mpd_recv_song_id(conn->h());
+				return (ids[n] != -1 && mpd_response_next(conn->h()));
+			},
+			succeeded);
+	} else {
+		run_command_lists(songs.size(),
+			[&](uint32_t n) {
+				return mpd_send_playlist_add(conn->h(), filename, songs[n]->file.c_str());
+			},
+			[&](uint32_t n) {
+				ids[n] = n;
+				return mpd_response_next(conn->h());
+			},
+			succeeded);
+	}
+
+	for (i = 0; i < songs.size(); i++) {
+		if (succeeded[i]) {
+			return ids[i];
+		}
+	}
+
+	return MPD_SONG_NO_ID;
+}
+
+/*
+ * Remove many songs from the queue or a stored playlist, using command
+ * lists. 'succeeded' tells which of the songs were removed.
+ *
+ * Returns true if all songs were removed, false otherwise.
+ */
+bool
+Control::remove(Songlist * list, const vector<ListItemSong *> & items, vector<bool> & succeeded)
+{
+	vector<uint32_t>		order;
+	vector<bool>			done;
+	const char *			filename;
+	bool				sent;
+	uint32_t			i;
+
+	assert(list != NULL);
+	assert(list != _library);
+
+	succeeded.assign(items.size(), false);
+
+	pms->log(MSG_DEBUG, 0, "Removing %u songs from list %s\n", items.size(), list->title());
+
+	if (list == _queue) {
+		if (!run_command_lists(items.size(),
+			[&](uint32_t n) {
+				assert(items[n]->id != MPD_SONG_NO_ID);
+				return mpd_send_delete_id(conn->h(), items[n]->id);
+			},
+			[&](uint32_t n) {
+				return mpd_response_next(conn->h());
+			},
+			succeeded)) {
+			return false;
+		}
+	} else {
+		assert(list->filename.size() > 0);
+		filename = list->filename.c_str();
+
+		/* Stored playlists are edited by position. Delete from the
+		 * end, so that the remaining positions stay valid. */
+		order.resize(items.size());
+		for (i = 0; i < order.size(); i++) {
+			order[i] = i;
+		}
+		std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+			return items[a]->pos > items[b]->pos;
+		});
+
+		sent = run_command_lists(order.size(),
+			[&](uint32_t n) {
+				return mpd_send_playlist_delete(conn->h(), filename, items[order[n]]->pos);
+			},
+			[&](uint32_t n) {
+				return mpd_response_next(conn->h());
+			},
+			done);
+
+		/* Report results in the order the items were given */
+		for (i = 0; i < order.size(); i++) {
+			succeeded[order[i]] = done[i];
+		}
+
+		static_cast<Playlist *>(list)->set_synchronized(false);
+
+		if (!sent) {
+			return false;
 		}
-		if (first == MPD_SONG_NO_ID) {
-			first = result;
+	}
+
+	for (i = 0; i < succeeded.size(); i++) {
+		if (!succeeded[i]) {
+			return false;
 		}
 	}
 
-	return first;
+	return true;
 }
 
 /*
@@ -832,7 +1059,6 @@ song_t
 Control::add(Songlist * list, Song * song)
 {
 	song_t		i = MPD_SONG_NO_ID;
-	Song *		nsong;
 
 	assert(list != NULL);
 	assert(song != NULL);
@@ -852,28 +1078,6 @@ Control::add(Songlist * list, Song * song)
 
 	return i;
 
-	/* FIXME
-	if (command_mode != 0) return i;
-	if (finish())
-	{
-		nsong = new Song(song);
-		if (list == _queue)
-		{
-			nsong->id = i;
-			nsong->pos = playlist()->size();
-			increment();
-		}
-		else
-		{
-			nsong->id = MPD_SONG_NO_ID;
-			nsong->pos = MPD_SONG_NO_NUM;
-			i = list->size();
-		}
-		list->add(nsong);
-	}
-
-	return i;
-	*/
 }
 
 /*
@@ -882,30 +1086,33 @@ Control::add(Songlist * list, Song * song)
  * Returns true on success, false on failure.
  */
 bool
-Control::remove(Songlist * list, Song * song)
+Control::remove(Songlist * list, ListItemSong * list_item)
 {
 	Playlist * playlist;
+	Song * song;
 
+	assert(list_item != NULL);
+	song = list_item->song;
 	assert(song != NULL);
 	assert(list != NULL);
 	assert(list != _library);
 
 	EXIT_IDLE;
 
-	pms->log(MSG_DEBUG, 0, "Removing song with id=%d pos=%d uri=%s from list %s.\n", song->id, song->pos, song->file.c_str(), list->filename.c_str());
+	pms->log(MSG_DEBUG, 0, "Removing song with id=%d pos=%d uri=%s from list %s.\n", list_item->id, list_item->pos, song->file.c_str(), list->filename.c_str());
 
 	/* Remove song from queue */
 	if (list == _queue) {
 		// All songs must have ID's
 		// FIXME: version requirement
-		assert(song->id != MPD_SONG_NO_ID);
-		return mpd_run_delete_id(conn->h(), song->id);
+		assert(list_item->id != MPD_SONG_NO_ID);
+		return mpd_run_delete_id(conn->h(), list_item->id);
 	}
 
 	/* Remove song from stored playlist */
 	assert(list->filename.size() > 0);
 
-	if (mpd_run_playlist_delete(conn->h(), (char *)list->filename.c_str(), song->pos)) {
+	if (mpd_run_playlist_delete(conn->h(), (char *)list->filename.c_str(), list_item->pos)) {
 		playlist = static_cast<Playlist *>(list);
 		playlist->set_synchronized(false);
 	}
@@ -948,8 +1155,6 @@ Control::clear(Songlist * list)
 bool
 Control::seek(int offset)
 {
-	EXIT_IDLE;
-
 	pms->log(MSG_DEBUG, 0, "Seeking by %d seconds\n", offset);
 
 	/* FIXME: perhaps this check should be performed at an earlier stage? */
@@ -959,7 +1164,7 @@ Control::seek(int offset)
 
 	offset = st->time_elapsed + offset;
 
-	return mpd_run_seek_id(conn->h(), song()->id, offset);
+	return (async_ready() && _async->send(async_result, "seekid", Pms::tostring(_song_id).c_str(), Pms::tostring(offset).c_str(), NULL));
 }
 
 /*
@@ -969,16 +1174,14 @@ Control::seek(int offset)
 int
 Control::crossfade()
 {
-	EXIT_IDLE;
-
 	pms->log(MSG_DEBUG, 0, "Toggling crossfade\n");
 
 	if (st->crossfade == 0) {
-		return mpd_run_crossfade(conn->h(), crossfadetime);
+		return (async_ready() && _async->send(async_result, "crossfade", Pms::tostring(crossfadetime).c_str(), NULL));
 	}
 
 	crossfadetime = st->crossfade;
-	return mpd_run_crossfade(conn->h(), 0);
+	return (async_ready() && _async->send(async_result, "crossfade", "0", NULL));
 }
 
 /*
@@ -988,8 +1191,6 @@ Control::crossfade()
 int
 Control::crossfade(int interval)
 {
-	EXIT_IDLE;
-
 	pms->log(MSG_DEBUG, 0, "Set crossfade to %d seconds\n", interval);
 
 	if (interval < 0) {
@@ -997,121 +1198,184 @@ Control::crossfade(int interval)
 	}
 
 	crossfadetime = interval;
-	return mpd_run_crossfade(conn->h(), crossfadetime);
+	return (async_ready() && _async->send(async_result, "crossfade", Pms::tostring(crossfadetime).c_str(), NULL));
 }
 
 /*
- * Move selected songs
+ * Move selected songs by 'offset' places. The offset is reduced if the
+ * selection would otherwise be moved past either end of the list.
+ *
+ * Contiguous runs of selected songs in the queue are moved with a single
+ * range move. The moves are sent in command lists, starting with the run
+ * furthest in the direction of the move, so that the original positions
+ * of the remaining runs stay valid.
+ *
+ * Returns the number of songs moved.
  */
 unsigned int
 Control::move(Songlist * list, int offset)
 {
-	ListItem *	item;
-	ListItemSong *	song_item;
-	Song *		song;
-	int		newpos;
-	const char *	filename;
-	unsigned int	moved = 0;
-
-
-	/* FIXME: this function must be moved to the Songlist class */
-	assert(false);
+	vector<ListItem *>::iterator		iter;
+	vector<uint32_t>			positions;
+	vector<pair<uint32_t, uint32_t> >	runs;
+	vector<bool>				succeeded;
+	const char *				filename;
+	uint32_t				i;
+	bool					queue;
 
 	/* Library is read only */
 	/* FIXME: error message */
 	if (list == _library || !list)
 		return 0;
 
+	queue = (list == _queue);
 	filename = list->filename.c_str();
 
-	if (offset < 0) {
-		//item = list->get_next_selected();
-	} else {
-		//item = list->get_prev_selected();
+	for (iter = list->selection_begin(); iter != list->selection_end(); ++iter) {
+		assert(LISTITEMSONG(*iter)->pos != MPD_SONG_NO_NUM);
+		positions.push_back(LISTITEMSONG(*iter)->pos);
 	}
 
-	song_item = dynamic_cast<ListItemSong *>(item);
-	song = song_item->song;
-
-	EXIT_IDLE;
-
-	//list_start();
+	if (positions.empty()) {
+		return 0;
+	}
 
-	while (song != NULL)
-	{
-		assert(song->pos != MPD_SONG_NO_NUM);
+	if (offset < 0 && (int)positions.front() + offset < 0) {
+		offset = -(int)positions.front();
+	} else if (offset > 0 && positions.back() + offset >= list->size()) {
+		offset = list->size() - 1 - positions.back();
+	}
 
-		newpos = song->pos + offset;
+	if (offset == 0) {
+		return 0;
+	}
 
-		if (!list->move(song->pos, newpos)) {
-			break;
+	/* Split the selection into runs of [start, end) positions. Stored
+	 * playlists can only move one song at a time. */
+	for (i = 0; i < positions.size(); i++) {
+		if (queue && runs.size() && runs.back().second == positions[i]) {
+			++runs.back().second;
+		} else {
+			runs.push_back(make_pair(positions[i], positions[i] + 1));
 		}
+	}
+
+	if (offset > 0) {
+		std::reverse(runs.begin(), runs.end());
+	}
 
-		++moved;
+	pms->log(MSG_DEBUG, 0, "Moving %u songs in %u runs by %d in list %s\n", positions.size(), runs.size(), offset, list->title());
 
-		if (list != _queue) {
-			if (!mpd_send_playlist_move(conn->h(), filename, song->pos, newpos)) {
-				break;
-			}
-		} else {
-			if (!mpd_run_move(conn->h(), song->pos, song->pos)) {
-				break;
+	if (!run_command_lists(runs.size(),
+		[&](uint32_t n) {
+			if (!queue) {
+				return mpd_send_playlist_move(conn->h(), filename, runs[n].first, runs[n].first + offset);
+			} else if (runs[n].second - runs[n].first == 1) {
+				return mpd_send_move(conn->h(), runs[n].first, runs[n].first + offset);
 			}
-		}
+			return mpd_send_move_range(conn->h(), runs[n].first, runs[n].second, runs[n].first + offset);
+		},
+		[&](uint32_t n) {
+			return mpd_response_next(conn->h());
+		},
+		succeeded)) {
+		return 0;
+	}
 
-		if (offset < 0) {
-			//item = list->get_next_selected();
-		} else {
-			//item = list->get_prev_selected();
+	for (i = 0; i < succeeded.size(); i++) {
+		if (!succeeded[i]) {
+			/* Let the next update bring the list in line with MPD */
+			if (!queue) {
+				static_cast<Playlist *>(list)->set_synchronized(false);
+			}
+			return 0;
 		}
-
-		song_item = dynamic_cast<ListItemSong *>(item);
-		song = song_item->song;
-
 	}
 
-	return get_error_bool();
+	list->move_local(positions, offset);
+
+	return positions.size();
 }
 
 
 /*
- * Starts mpd command list/queue mode
- * FIXME: not implemented
+ * Send a series of commands to MPD in command lists of at most
+ * 'commandlistsize' commands each, so that a large operation costs a few
+ * round trips instead of one per command.
+ *
+ * 'send' is called with the index of each command and must send it.
+ * 'receive' is called with the same index and must read that command's
+ * response up to and including its list_OK, using mpd_response_next().
+ *
+ * When MPD rejects a command, the rest of that command list is not
+ * executed. The error is logged for the failed command, and sending
+ * resumes with the next one. 'succeeded' is set to tell which of the
+ * commands were carried out.
+ *
+ * Returns true if all commands were sent, or false if the connection failed.
  */
 bool
-Control::list_start()
+Control::run_command_lists(uint32_t count, const command_function & send, const command_function & receive, vector<bool> & succeeded)
 {
-	assert(0);
+	uint32_t	start = 0;
+	uint32_t	end;
+	uint32_t	batch;
+	uint32_t	i;
+
+	succeeded.assign(count, false);
 
 	EXIT_IDLE;
 
-	pms->log(MSG_DEBUG, 0, "Entering command list mode.\n");
+	batch = (pms->options->commandlistsize > 0 ? pms->options->commandlistsize : 1);
 
-	if (mpd_command_list_begin(conn->h(), true)) {
-		command_mode = 1;
-	}
+	while (start < count) {
 
-	return get_error_bool();
-}
+		end = (count - start > batch ? start + batch : count);
 
-/*
- * Ends mpd command list/queue mode
- * FIXME: not implemented
- */
-bool
-Control::list_end()
-{
-	assert(0);
+		pms->log(MSG_DEBUG, 0, "Sending commands %u to %u of %u in a command list.\n", start + 1, end, count);
 
-	EXIT_IDLE;
+		if (!mpd_command_list_begin(conn->h(), true)) {
+			return false;
+		}
+		for (i = start; i < end; i++) {
+			if (!send(i)) {
+				return false;
+			}
+		}
+		if (!mpd_command_list_end(conn->h())) {
+			return false;
+		}
+
+		for (i = start; i < end; i++) {
+			if (!receive(i)) {
+				break;
+			}
+			succeeded[i] = true;
+		}
+
+		if (i == end) {
+			if (!mpd_response_finish(conn->h())) {
+				return false;
+			}
+			start = end;
+			continue;
+		}
+
+		/* Anything but a rejected command is fatal */
+		if (mpd_connection_get_error(conn->h()) != MPD_ERROR_SERVER) {
+			return false;
+		}
+
+		pms->log(MSG_DEBUG, 0, "Command %u of %u failed: %s\n", i + 1, count, mpd_connection_get_error_message(conn->h()));
 
-	pms->log(MSG_DEBUG, 0, "Leaving command list mode.\n");
+		if (!mpd_connection_clear_error(conn->h())) {
+			return false;
+		}
 
-	if (mpd_command_list_end(conn->h())) {
-		command_mode = 0;
+		start = i + 1;
 	}
 
-	return get_error_bool();
+	return true;
 }
 
 /*
@@ -1120,35 +1384,111 @@ Control::list_end()
 bool
 Control::get_status()
 {
-	mpd_status *	status;
-	mpd_stats *	stats;
+	return refresh_status(false, false);
+}
+
+/*
+ * Retrieves the status of MPD, and optionally the currently playing song and
+ * the database statistics, in a single command list. The statistics are
+ * expensive to compute on large databases, so only ask for them when the
+ * database has changed.
+ *
+ * Returns true on success, false on failure.
+ */
+bool
+Control::refresh_status(bool current_song, bool stats)
+{
+	struct mpd_song *	song = NULL;
+	mpd_status *		status = NULL;
+	mpd_stats *		statistics = NULL;
+	bool			ok;
 
 	EXIT_IDLE;
 
-	pms->log(MSG_DEBUG, 0, "Retrieving MPD status from server.\n");
+	pms->log(MSG_DEBUG, 0, "Retrieving MPD status%s%s from server.\n",
+			(current_song ? ", current song" : ""),
+			(stats ? ", statistics" : ""));
+
+	ok = (mpd_command_list_begin(conn->h(), true)
+		&& (!current_song || mpd_send_current_song(conn->h()))
+		&& mpd_send_status(conn->h())
+		&& (!stats || mpd_send_stats(conn->h()))
+		&& mpd_command_list_end(conn->h()));
+
+	/* There is no song if MPD is stopped */
+	if (ok && current_song) {
+		song = mpd_recv_song(conn->h());
+		ok = (get_error_bool() && mpd_response_next(conn->h()));
+	}
+
+	if (ok) {
+		status = mpd_recv_status(conn->h());
+		ok = (status != NULL && mpd_response_next(conn->h()));
+	}
+
+	if (ok && stats) {
+		statistics = mpd_recv_stats(conn->h());
+		ok = (statistics != NULL && mpd_response_next(conn->h()));
+	}
+
+	ok = (ok && mpd_response_finish(conn->h()));
 
-	if ((status = mpd_run_status(conn->h())) == NULL) {
+	if (!ok) {
 		/* FIXME: error handling? */
-		pms->log(MSG_DEBUG, 0, "mpd_run_status returned NULL pointer.\n");
-		delete _song;
-		_song = NULL;
+		pms->log(MSG_DEBUG, 0, "Retrieving MPD status failed: %s\n", mpd_connection_get_error_message(conn->h()));
+		if (song) {
+			mpd_song_free(song);
+		}
+		if (status) {
+			mpd_status_free(status);
+		}
+		if (statistics) {
+			mpd_stats_free(statistics);
+		}
+		if (_song != NULL) {
+			_song->release();
+			_song = NULL;
+		}
+		_song_pos = MPD_SONG_NO_NUM;
+		_song_id = MPD_SONG_NO_ID;
 		st->song = MPD_SONG_NO_NUM;
 		st->songid = MPD_SONG_NO_ID;
 		return false;
 	}
 
+	if (current_song) {
+		if (_song != NULL) {
+			_song->release();
+			_song = NULL;
+		}
+
+		_song_pos = MPD_SONG_NO_NUM;
+		_song_id = MPD_SONG_NO_ID;
+
+		if (song) {
+			_song = Song::acquire(song);
+			_song_pos = mpd_song_get_pos(song);
+			_song_id = mpd_song_get_id(song);
+			mpd_song_free(song);
+		}
+	}
+
 	st->assign_status(status);
 	mpd_status_free(status);
 
-	if ((stats = mpd_run_stats(conn->h())) == NULL) {
-		/* FIXME ? */
-		pms->log(MSG_DEBUG, 0, "mpd_run_stats returned NULL pointer.\n");
-		return false;
+	if (statistics) {
+		/* A restarted server numbers queue versions and song ids
+		 * afresh, so the local queue can not be patched. Stats may
+		 * be hours old, so compare against the uptime MPD should have
+		 * now, allowing a second or two for rounding. */
+		if (st->uptime_sampled > 0 && mpd_stats_get_uptime(statistics) + 2 < st->uptime + (time(NULL) - st->uptime_sampled)) {
+			pms->log(MSG_DEBUG, 0, "MPD has been restarted, reloading the queue.\n");
+			st->last_playlist = -1;
+		}
+		st->assign_stats(statistics);
+		mpd_stats_free(statistics);
 	}
 
-	st->assign_stats(stats);
-	mpd_stats_free(stats);
-
 	return true;
 }
 
@@ -1157,62 +1497,96 @@ Directory::Directory(Directory * par, string n)
 	parent_ = par;
 	name_ = n;
 	cursor = 0;
+
+	if (parent_ == NULL) {
+		path_ = "";
+	} else if (parent_->path_.size() == 0) {
+		path_ = name_;
+	} else {
+		path_ = parent_->path_ + '/' + name_;
+	}
 }
 
-/*
- * Return full path from top-level to here
- */
-string				Directory::path()
+Directory::~Directory()
 {
-	if (parent_ == NULL)
-		return "";
-	else if (parent_->name().size() == 0)
-		return name_;
-	else
-		return (parent_->path() + '/' + name_);
+	clear();
 }
 
-/*
+void
+Directory::clear()
+{
+	vector<Directory *>::iterator	it;
+
+	for (it = children.begin(); it != children.end(); ++it) {
+		delete *it;
+	}
+
+	children.clear();
+	index.clear();
+	songs.clear();
+	cursor = 0;
+}
+
+Directory *
+Directory::child(const string & name)
+{
+	childmap::iterator		it;
+
+	it = index.find(name);
+
+	return (it == index.end() ? NULL : it->second);
+}
+
+/*
  * Adds a directory entry to the tree
  */
-Directory *			Directory::add(string s)
+Directory *
+Directory::add(const string & path, Directory * hint)
 {
-	size_t				i;
-	string				t;
-	vector<Directory *>::iterator	it;
+	Directory *			dir = this;
 	Directory *			d;
+	string				name;
+	size_t				start = 0;
+	size_t				end;
 
-	if (s.size() == 0)
-		return NULL;
-
-	i = s.find_first_of('/');
+	/* Hints are full paths, and only work from the top */
+	assert(hint == NULL || parent_ == NULL);
 
-	/* Within this directory */
-	if (i == string::npos)
-	{
-		d = new Directory(this, s);
-		children.push_back(d);
-		return d;
+	/* Climb up from the hint until we reach a directory which contains
+	 * the path, and continue from there. */
+	for (d = hint; d != NULL && d != this; d = d->parent_) {
+		if (path.size() < d->path_.size() || path.compare(0, d->path_.size(), d->path_) != 0) {
+			continue;
+		}
+		if (path.size() == d->path_.size()) {
+			return d;
+		}
+		if (path[d->path_.size()] == '/') {
+			dir = d;
+			start = d->path_.size() + 1;
+			break;
+		}
 	}
 
-	t = s.substr(0, i);		// top-level
-	s = s.substr(i + 1);		// all sub-level
+	/* Walk down the rest of the path, creating what is missing */
+	while (start < path.size()) {
+		end = path.find('/', start);
+		if (end == string::npos) {
+			end = path.size();
+		}
 
-	/* Search for top-level string in subdirectories */
-	it = children.begin();
-	while (it != children.end())
-	{
-		if ((*it)->name() == t)
-		{
-			return (*it)->add(s);
+		name = path.substr(start, end - start);
+		if ((d = dir->child(name)) == NULL) {
+			d = new Directory(dir, name);
+			dir->children.push_back(d);
+			dir->index[name] = d;
 		}
-		++it;
-	}
 
-	/* Not found, this should _not_ happen */
-	pms->log(MSG_DEBUG, 0, "BUG: directory not found in hierarchy: '%s', '%s'\n", t.c_str(), s.c_str());
+		dir = d;
+		start = end + 1;
+	}
 
-	return NULL;
+	return dir;
 }
 
 /*
@@ -1240,57 +1614,232 @@ void		Directory::debug_tree()
 */
 
 /*
- * Retrieves the entire song library from MPD
+ * Write memory and allocation statistics to the debug log.
+ */
+static void
+log_memory_usage(const char * when)
+{
+	pms->log(MSG_DEBUG, 0, "Memory usage %s: RSS %ld KiB, peak RSS %ld KiB, %lu songs in %lu allocations, %lu list items in %lu allocations\n",
+			when, current_rss(), peak_rss(),
+			Song::slab().live(), Song::slab().allocations(),
+			ListItemSong::slab().live(), ListItemSong::slab().allocations());
+}
+
+/*
+ * Milliseconds elapsed since a point in time.
+ */
+static long
+elapsed_ms(struct timespec since)
+{
+	struct timespec		elapsed;
+
+	elapsed = difftime(since, pms->get_clock());
+
+	return elapsed.tv_sec * 1000 + elapsed.tv_nsec / 1000000;
+}
+
+/*
+ * Retrieves the entire song library from MPD.
+ *
+ * A full download is received in chunks, one chunk per call, so that the
+ * main loop can keep handling input in between. Use library_loading() to
+ * find out if the download is still in progress.
  */
 bool
 Control::update_library()
 {
-	uint32_t			total = 0;
-	Song *				song;
-	struct mpd_entity *		ent;
-	const struct mpd_directory *	ent_directory;
-	const struct mpd_song *		ent_song;
-	const struct mpd_playlist *	ent_playlist;
-	Directory *			dir = rootdir;
+	uint32_t			i;
+	unsigned long			since;
+	bool				result;
+
+	/* Continue a download in progress */
+	if (_library_loading) {
+		return receive_library(LIBRARY_CHUNK_SIZE);
+	}
 
 	EXIT_IDLE;
 
+	_library_started = pms->get_clock();
+
 	pms->log(MSG_DEBUG, 0, "Updating library from DB time %d to %d\n", st->last_db_update_time, st->db_update_time);
-	st->last_db_update_time = st->db_update_time;
+	since = st->last_db_update_time;
+	_library_db_update_time = st->db_update_time;
+
+	/* On startup, try the copy saved by the previous session. If MPD's
+	 * database has not been updated since, there is nothing to fetch. */
+	if (_library->size() == 0 && pms->options->librarycache && load_library_cache(&since)) {
+		if (since == st->db_update_time) {
+			st->last_db_update_time = st->db_update_time;
+			rebuild_directories();
+			pms->log(MSG_DEBUG, 0, "Library cache is up to date, loaded in %ld ms\n",
+					elapsed_ms(_library_started));
+			return true;
+		}
+		pms->log(MSG_DEBUG, 0, "Library cache is from DB time %lu, synchronizing\n", since);
+	}
+
+	/* Nothing to do if the database has not changed, e.g. after a
+	 * reconnect. */
+	if (_library->size() > 0 && since > 0 && since == st->db_update_time) {
+		pms->log(MSG_DEBUG, 0, "Library is up to date.\n");
+		st->last_db_update_time = st->db_update_time;
+		return true;
+	}
+
+	/* Only fetch the differences if we already have a library, and the
+	 * server supports searching on modification time. */
+	if (_library->size() > 0 && since > 0 && mpd_connection_cmp_server_version(conn->h(), 0, 19, 0) >= 0) {
+		if (!sync_library(since)) {
+			rebuild_directories();
+			return false;
+		}
+		st->last_db_update_time = _library_db_update_time;
+		rebuild_directories();
+		pms->log(MSG_DEBUG, 0, "Library synchronized in %ld ms\n",
+				elapsed_ms(_library_started));
+		return true;
+	}
+
+	log_memory_usage("before library update");
+
+	/* An empty library is filled as songs arrive, so that it can be
+	 * used right away. Otherwise the new library is collected on the
+	 * side, and replaces the old one when complete. */
+	_library_progressive = (_library->size() == 0);
+
+	if (!start_library_download(true)) {
+		return false;
+	}
+
+	return receive_library(LIBRARY_CHUNK_SIZE);
+}
+
+int
+Control::get_fetcher_file_descriptor()
+{
+	return (_fetcher ? _fetcher->get_file_descriptor() : -1);
+}
+
+/*
+ * Request the whole library from MPD. The download runs in a worker thread
+ * with a connection of its own if 'background' is set and the thread can be
+ * started, or on the main connection otherwise.
+ *
+ * Returns true on success, false on failure.
+ */
+bool
+Control::start_library_download(bool background)
+{
+	assert(!_library_loading);
+	assert(_fetcher == NULL);
+
+	/* The tree is rebuilt from the entities as they arrive */
+	rootdir->clear();
+	_library_dir = rootdir;
+	_library_received = 0;
+
+	if (background) {
+		_fetcher = new Fetcher(pms->options->host, pms->options->port,
+				pms->options->mpd_timeout * 1000, pms->options->password);
+		if (_fetcher->start()) {
+			_library_loading = true;
+			return true;
+		}
+		pms->log(MSG_DEBUG, 0, "Could not start library download thread, using the main connection\n");
+		delete _fetcher;
+		_fetcher = NULL;
+	}
+
+	EXIT_IDLE;
 
 	if (!mpd_send_list_all_meta(conn->h(), "")) {
 		return false;
 	}
 
-	_library->clear();
+	_library_loading = true;
 
-	while ((ent = mpd_recv_entity(conn->h())) != NULL)
+	return true;
+}
+
+/*
+ * Throw away the songs received so far by a library download.
+ */
+void
+Control::discard_library_download()
+{
+	vector<Song *>::iterator	iter;
+
+	if (_library_progressive) {
+		_library->clear();
+	}
+
+	/* The tree holds the downloaded songs, so it must go first. Rebuild
+	 * it from whatever is left in the library. */
+	rebuild_directories();
+	_library_dir = rootdir;
+
+	for (iter = _library_pending.begin(); iter != _library_pending.end(); ++iter) {
+		(*iter)->release();
+	}
+	_library_pending.clear();
+}
+
+/*
+ * Receive up to 'limit' entities of a library download, or all of the
+ * remaining ones if 'limit' is zero.
+ *
+ * Returns true on success, false on failure.
+ */
+bool
+Control::receive_library(uint32_t limit)
+{
+	vector<struct mpd_entity *>		entities;
+	vector<struct mpd_entity *>::iterator	iter;
+	vector<Song *>::iterator		pending;
+	bool					finished = false;
+	string					error;
+	Song *					song;
+	struct mpd_entity *			ent;
+	const struct mpd_directory *		ent_directory;
+	const struct mpd_song *			ent_song;
+	const struct mpd_playlist *		ent_playlist;
+
+	assert(_library_loading);
+
+	if (_fetcher) {
+		finished = _fetcher->take(entities, limit);
+	} else {
+		while (limit == 0 || entities.size() < limit) {
+			if ((ent = mpd_recv_entity(conn->h())) == NULL) {
+				finished = true;
+				break;
+			}
+			entities.push_back(ent);
+		}
+	}
+
+	for (iter = entities.begin(); iter != entities.end(); ++iter)
 	{
-		switch(mpd_entity_get_type(ent))
+		switch(mpd_entity_get_type(*iter))
 		{
 			case MPD_ENTITY_TYPE_SONG:
-				ent_song = mpd_entity_get_song(ent);
-				song = new Song(ent_song);
-				song->id = MPD_SONG_NO_ID;
-				song->pos = MPD_SONG_NO_NUM;
-				_library->add_local(song);
-				dir->songs.push_back(song);
+				ent_song = mpd_entity_get_song(*iter);
+				song = Song::acquire(ent_song);
+				if (_library_progressive) {
+					_library->add_local(song);
+				} else {
+					_library_pending.push_back(song);
+				}
+				_library_dir->songs.push_back(song);
 				break;
 			case MPD_ENTITY_TYPE_PLAYLIST:
 				/* Issue #8: https://github.com/ambientsound/pms/issues/8 */
-				ent_playlist = mpd_entity_get_playlist(ent);
+				ent_playlist = mpd_entity_get_playlist(*iter);
 				//pms->log(MSG_DEBUG, 0, "NOT IMPLEMENTED in update_library(): got playlist entity in update_library(): %s\n", mpd_playlist_get_path(ent_playlist));
 				break;
 			case MPD_ENTITY_TYPE_DIRECTORY:
-				ent_directory = mpd_entity_get_directory(ent);
-				dir = rootdir->add(mpd_directory_get_path(ent_directory));
-				assert(dir != NULL);
-				/*
-				if (dir == NULL)
-				{
-					dir = rootdir;
-				}
-				*/
+				ent_directory = mpd_entity_get_directory(*iter);
+				_library_dir = rootdir->add(mpd_directory_get_path(ent_directory), _library_dir);
 				break;
 			case MPD_ENTITY_TYPE_UNKNOWN:
 				pms->log(MSG_DEBUG, 0, "BUG in update_library(): entity type not implemented by libmpdclient\n");
@@ -1300,14 +1849,263 @@ Control::update_library()
 				break;
 		}
 
+		mpd_entity_free(*iter);
+
+		++_library_received;
+	}
+
+	/* More to come */
+	if (!finished) {
+		pms->log(MSG_STATUS, STOK, _("Loading library: %lu/%ld songs"),
+				_library_progressive ? _library->size() : _library_pending.size(),
+				st->songs_count);
+		return true;
+	}
+
+	_library_loading = false;
+
+	if (_fetcher) {
+		error = _fetcher->error();
+		delete _fetcher;
+		_fetcher = NULL;
+
+		/* The server may not accept another connection. Start over
+		 * on the main connection. */
+		if (!error.empty()) {
+			pms->log(MSG_DEBUG, 0, "Library download thread failed: %s\n", error.c_str());
+			discard_library_download();
+			return start_library_download(false);
+		}
+	} else if (!get_error_bool()) {
+		discard_library_download();
+		return false;
+	}
+
+	/* Replace the old library in one go. The pending list holds a
+	 * reference to each song, which is handed over to the library. */
+	if (!_library_progressive) {
+		_library->clear();
+		for (pending = _library_pending.begin(); pending != _library_pending.end(); ++pending) {
+			_library->add_local(*pending);
+		}
+		_library_pending.clear();
+	}
+
+	pms->log(MSG_DEBUG, 0, "Processed a total of %d entities during library update\n", _library_received);
+
+	log_memory_usage("after library update");
+
+	pms->log(MSG_DEBUG, 0, "Library downloaded in %ld ms\n",
+			elapsed_ms(_library_started));
+
+	st->last_db_update_time = _library_db_update_time;
+
+	set_update_done(MPD_IDLE_DATABASE);
+
+	return true;
+}
+
+/*
+ * Rebuild the directory tree from the songs in the library, after the
+ * library has been changed other than by a full download.
+ */
+void
+Control::rebuild_directories()
+{
+	Directory *	dir = rootdir;
+	Song *		song;
+	uint32_t	i;
+
+	rootdir->clear();
+
+	for (i = 0; i < _library->size(); i++) {
+		song = _library->song(i);
+		dir = rootdir->add(song->dirname(), dir);
+		dir->songs.push_back(song);
+	}
+}
+
+/*
+ * Fill the empty library from the on-disk cache, and return the database
+ * update time the cache was saved with.
+ *
+ * Returns true if the cache was loaded, false otherwise.
+ */
+bool
+Control::load_library_cache(unsigned long * db_update_time)
+{
+	Librarycache	cache(pms->options->host, pms->options->port);
+
+	assert(_library->size() == 0);
+
+	if (!cache.load(_library, db_update_time)) {
+		return false;
+	}
+
+	_library_cache_time = *db_update_time;
+
+	return true;
+}
+
+/*
+ * Save the library to the on-disk cache, so that the next session can start
+ * without downloading it. Should be called after sorting the library, so
+ * that the cache is stored in display order. Nothing is written if the
+ * cache already holds this version of the database.
+ *
+ * Returns true on success, false on failure.
+ */
+bool
+Control::save_library_cache()
+{
+	Librarycache	cache(pms->options->host, pms->options->port);
+
+	if (!pms->options->librarycache || st->last_db_update_time == _library_cache_time) {
+		return true;
+	}
+
+	if (!cache.save(_library, st->last_db_update_time)) {
+		return false;
+	}
+
+	_library_cache_time = st->last_db_update_time;
+
+	return true;
+}
+
+/*
+ * Brings the library up to date with the MPD database without downloading
+ * all of it. Songs modified since the given database update time are
+ * re-read, songs no longer in the database are removed, and songs which
+ * are new to the library are fetched one by one.
+ *
+ * Returns true on success, false on failure.
+ */
+bool
+Control::sync_library(unsigned long since)
+{
+	typedef unordered_map<Tag, uint32_t, TagHash>	urimap;
+
+	urimap				positions;
+	urimap::iterator		position;
+	vector<bool>			seen;
+	vector<uint32_t>		gone;
+	vector<string>			missing;
+	vector<bool>			fetched;
+	uint32_t			size;
+	uint32_t			i;
+	uint32_t			changed = 0;
+	uint32_t			added = 0;
+	uint32_t			removed = 0;
+	Song *				song;
+	struct mpd_song *		mpd_song;
+	const struct mpd_song *		ent_song;
+	struct mpd_entity *		ent;
+
+	EXIT_IDLE;
+
+	size = _library->size();
+	seen.resize(size, false);
+	positions.reserve(size);
+	for (i = 0; i < size; i++) {
+		positions[_library->song(i)->file] = i;
+	}
+
+	/* Songs modified since the last update. Shared songs are updated in
+	 * place by Song::acquire(), so only new songs need to be added. */
+	if (!mpd_search_db_songs(conn->h(), false)) {
+		return false;
+	}
+	if (!mpd_search_add_modified_since_constraint(conn->h(), MPD_OPERATOR_DEFAULT, since)) {
+		mpd_search_cancel(conn->h());
+		return false;
+	}
+	if (!mpd_search_commit(conn->h())) {
+		return false;
+	}
+
+	while ((mpd_song = mpd_recv_song(conn->h())) != NULL) {
+		song = Song::acquire(mpd_song);
+		if (positions.find(song->file) == positions.end()) {
+			positions[song->file] = _library->add_local(song);
+			seen.push_back(true);
+			++added;
+		} else {
+			song->release();
+			++changed;
+		}
+		mpd_song_free(mpd_song);
+	}
+
+	if (!get_error_bool()) {
+		return false;
+	}
+
+	/* Walk the URI list of the whole database to find removed songs, and
+	 * new songs which did not show up in the search above. */
+	if (!mpd_send_list_all(conn->h(), "")) {
+		return false;
+	}
+
+	while ((ent = mpd_recv_entity(conn->h())) != NULL) {
+		if (mpd_entity_get_type(ent) == MPD_ENTITY_TYPE_SONG) {
+			ent_song = mpd_entity_get_song(ent);
+			position = positions.find(Tag(mpd_song_get_uri(ent_song)));
+			if (position != positions.end()) {
+				seen[position->second] = true;
+			} else {
+				missing.push_back(mpd_song_get_uri(ent_song));
+			}
+		}
 		mpd_entity_free(ent);
+	}
+
+	if (!get_error_bool()) {
+		return false;
+	}
 
-		++total;
+	/* Fetch metadata for songs which are new to us */
+	/* Fetch metadata for songs which are new to us. Songs which were
+	 * removed in the meantime are rejected by the server, and skipped. */
+	if (!missing.empty()) {
+		if (!run_command_lists(missing.size(),
+			[&](uint32_t n) {
+				return mpd_send_list_meta(conn->h(), missing[n].c_str());
+			},
+			[&](uint32_t n) {
+				while ((ent = mpd_recv_entity(conn->h())) != NULL) {
+					if (mpd_entity_get_type(ent) == MPD_ENTITY_TYPE_SONG) {
+						song = Song::acquire(mpd_entity_get_song(ent));
+						if (positions.find(song->file) == positions.end()) {
+							positions[song->file] = _library->add_local(song);
+							++added;
+						} else {
+							song->release();
+						}
+					}
+					mpd_entity_free(ent);
+				}
+				return (mpd_connection_get_error(conn->h()) == MPD_ERROR_SUCCESS && mpd_response_next(conn->h()));
+			},
+			fetched))
+		{
+			return false;
+		}
 	}
 
-	pms->log(MSG_DEBUG, 0, "Processed a total of %d entities during library update\n", total);
+	/* Remove songs which are gone. New songs were appended after the old
+	 * ones, so the old positions are still valid. */
+	for (i = 0; i < size; i++) {
+		if (!seen[i]) {
+			gone.push_back(i);
+		}
+	}
+	_library->remove_gone(gone);
+	removed = gone.size();
 
-	return get_error_bool();
+	pms->log(MSG_DEBUG, 0, "Library sync: %d songs changed, %d added, %d removed\n", changed, added, removed);
+
+	return true;
 }
 
 /*
@@ -1322,6 +2120,7 @@ Control::update_playlist_index()
 	struct mpd_playlist *		playlist;
 	Playlist *			local_playlist;
 	vector<Playlist *>::iterator	local_playlist_iterator;
+	playlistmap::iterator		index_iterator;
 
 	EXIT_IDLE;
 
@@ -1343,24 +2142,20 @@ Control::update_playlist_index()
 
 		name = mpd_playlist_get_path(playlist);
 
-		local_playlist_iterator = playlists.begin();
-		while (local_playlist_iterator != playlists.end()) {
-			if ((*local_playlist_iterator)->filename == name) {
-				local_playlist = *local_playlist_iterator;
-				break;
-			}
-			++local_playlist_iterator;
-		}
+		index_iterator = playlist_index.find(name);
 
-		if (local_playlist_iterator == playlists.end()) {
+		if (index_iterator != playlist_index.end()) {
+			local_playlist = index_iterator->second;
+			local_playlist->assign_metadata_from_mpd(playlist);
+		} else {
 			local_playlist = new Playlist();
 			local_playlist->filename = name;
+			local_playlist->assign_metadata_from_mpd(playlist);
 			playlists.push_back(local_playlist);
+			playlist_index[name] = local_playlist;
 			pms->disp->add_list(local_playlist);
 		}
 
-		local_playlist->assign_metadata_from_mpd(playlist);
-
 		pms->log(MSG_DEBUG, 0, "Playlist '%s' was last modified on %u\n", local_playlist->filename.c_str(), local_playlist->get_last_modified());
 
 		mpd_playlist_free(playlist);
@@ -1379,32 +2174,56 @@ bool
 Control::update_playlists()
 {
 	vector<Playlist *>::iterator	playlist_iterator;
+	vector<Playlist *>::iterator	kept;
+	vector<List *>			deleted;
+	vector<List *>::iterator	deleted_iterator;
 	Playlist *			playlist;
+	bool				result = true;
 
 	EXIT_IDLE;
 
 	pms->log(MSG_DEBUG, 0, "Synchronizing all playlists with MPD\n");
 
-	playlist_iterator = playlists.begin();
+	/* Deleted playlists are dropped by moving the remaining ones down in
+	 * a single pass. */
+	kept = playlists.begin();
 
-	while (playlist_iterator != playlists.end()) {
+	for (playlist_iterator = playlists.begin(); playlist_iterator != playlists.end(); ++playlist_iterator) {
 
 		playlist = *playlist_iterator;
 
 		if (!playlist->exists_in_mpd()) {
-			pms->disp->remove_list(playlist);
-			delete playlist;
-			playlist_iterator = playlists.erase(playlist_iterator);
+			playlist_index.erase(playlist->filename);
+			deleted.push_back(playlist);
+			continue;
+		}
+
+		*kept++ = playlist;
+
+		if (!result) {
+			continue;
+		} else if (!playlist->is_wanted()) {
+			/* Retrieved by require_playlist() when needed */
 			continue;
 		} else if (!playlist->is_synchronized()) {
-			if (!update_playlist(playlist)) {
-				return false;
+			if (!(result = update_playlist(playlist))) {
+				continue;
 			}
 			playlist->set_synchronized(true);
 		} else {
 			pms->log(MSG_DEBUG, 0, "Playlist %s is already synchronized.\n", playlist->filename.c_str());
 		}
-		++playlist_iterator;
+	}
+
+	playlists.erase(kept, playlists.end());
+
+	pms->disp->remove_lists(deleted);
+	for (deleted_iterator = deleted.begin(); deleted_iterator != deleted.end(); ++deleted_iterator) {
+		delete *deleted_iterator;
+	}
+
+	if (!result) {
+		return false;
 	}
 
 	pms->log(MSG_DEBUG, 0, "Playlist synchronization is finished.\n");
@@ -1412,6 +2231,119 @@ Control::update_playlists()
 	return get_error_bool();
 }
 
+/*
+ * Look up the songs for a list of URIs, adding a reference to each.
+ *
+ * Returns false, holding no references, if any of them is not known together
+ * with its tags.
+ */
+static bool
+find_songs(const vector<string> & uris, vector<Song *> & songs)
+{
+	vector<string>::const_iterator	uri;
+	vector<Song *>::iterator	song;
+	Song *				s;
+
+	songs.reserve(uris.size());
+
+	for (uri = uris.begin(); uri != uris.end(); ++uri) {
+		if ((s = Song::find(*uri)) == NULL || !s->tagged) {
+			break;
+		}
+		songs.push_back(s->retain());
+	}
+
+	if (uri == uris.end()) {
+		return true;
+	}
+
+	for (song = songs.begin(); song != songs.end(); ++song) {
+		(*song)->release();
+	}
+	songs.clear();
+
+	return false;
+}
+
+/*
+ * Make a playlist hold 'songs' from position 'from' onwards. Only the span
+ * between the entries which are unchanged at the start and at the end is
+ * replaced, so an edit in the middle of a long playlist touches only the
+ * entries that changed. The playlist takes over the references to the songs.
+ *
+ * Returns the number of entries in the replaced span.
+ */
+static uint32_t
+patch_playlist(Playlist * playlist, uint32_t from, const vector<Song *> & songs)
+{
+	uint32_t	old_size = playlist->size();
+	uint32_t	new_size = from + songs.size();
+	uint32_t	prefix = from;
+	uint32_t	suffix = 0;
+	uint32_t	i;
+
+	assert(from <= old_size);
+
+	while (prefix < old_size && prefix < new_size && playlist->song(prefix) == songs[prefix - from]) {
+		++prefix;
+	}
+
+	while (suffix < old_size - prefix && suffix < new_size - prefix
+			&& playlist->song(old_size - 1 - suffix) == songs[new_size - 1 - suffix - from]) {
+		++suffix;
+	}
+
+	/* Songs outside the span are already in the playlist */
+	for (i = from; i < prefix; i++) {
+		songs[i - from]->release();
+	}
+	for (i = new_size - suffix; i < new_size; i++) {
+		songs[i - from]->release();
+	}
+
+	playlist->replace_local(prefix, old_size - prefix - suffix,
+			vector<Song *>(songs.begin() + (prefix - from), songs.begin() + (new_size - suffix - from)));
+
+	return (old_size > new_size ? old_size : new_size) - prefix - suffix;
+}
+
+/*
+ * Retrieve the URIs in a stored playlist, from position 'from' to the end.
+ * Only servers which support ranges can be asked for anything but the whole
+ * playlist.
+ *
+ * Returns true on success, false on failure.
+ */
+bool
+Control::list_playlist(const string & filename, uint32_t from, vector<string> & uris)
+{
+	char		range[16];
+	mpd_entity *	ent;
+	bool		sent;
+
+	uris.clear();
+
+	if (from > 0) {
+		snprintf(range, sizeof(range), "%u:", from);
+		sent = mpd_send_command(conn->h(), "listplaylist", filename.c_str(), range, NULL);
+	} else {
+		sent = mpd_send_list_playlist(conn->h(), filename.c_str());
+	}
+
+	if (!sent) {
+		return false;
+	}
+
+	while ((ent = mpd_recv_entity(conn->h())) != NULL) {
+		if (mpd_entity_get_type(ent) == MPD_ENTITY_TYPE_SONG) {
+			uris.push_back(mpd_song_get_uri(mpd_entity_get_song(ent)));
+		}
+		mpd_entity_free(ent);
+	}
+
+	return get_error_bool();
+}
+
 /*
  * Retrieve the contents of a stored playlist. Will synchronize local playlists
  * with the MPD server, overwriting the local versions.
@@ -1421,44 +2353,99 @@ Control::update_playlists()
 bool
 Control::update_playlist(Playlist * playlist)
 {
-	Song *			song;
-	mpd_entity *		ent;
-	const mpd_song *	ent_song;
+	vector<string>			uris;
+	vector<Song *>			songs;
+	vector<Song *>::iterator	song;
+	uint32_t			from = 0;
+	uint32_t			changed;
+	uint32_t			i;
+	bool				appended = false;
+	bool				patched = false;
+	mpd_entity *			ent;
 
 	EXIT_IDLE;
 
-	pms->log(MSG_DEBUG, 0, "Retrieving playlist %s from MPD server.\n", playlist->filename.c_str());
+	/* A playlist we already have is patched in place. Only the URIs are
+	 * downloaded, and songs are looked up among the ones we know. */
+	if (playlist->size() > 0) {
 
-	if (!mpd_send_list_playlist_meta(conn->h(), playlist->filename.c_str())) {
-		return false;
+		pms->log(MSG_DEBUG, 0, "Comparing playlist %s with MPD server.\n", playlist->filename.c_str());
+
+		/* Playlists are mostly appended to. Servers which can list part
+		 * of a playlist send only the entries from just before the old
+		 * end, and if those are unchanged, the new ones are added.
+		 * Other edits which grow the playlist and leave its last
+		 * entries in place go unnoticed this way. */
+		if (playlist->size() > PLAYLIST_TAIL_OVERLAP && mpd_connection_cmp_server_version(conn->h(), 0, 24, 0) >= 0) {
+			from = playlist->size() - PLAYLIST_TAIL_OVERLAP;
+			if (!list_playlist(playlist->filename, from, uris)) {
+				return false;
+			}
+			appended = (uris.size() > PLAYLIST_TAIL_OVERLAP);
+			for (i = 0; appended && i < PLAYLIST_TAIL_OVERLAP; i++) {
+				appended = (playlist->song(from + i)->file == uris[i]);
+			}
+			if (appended) {
+				pms->log(MSG_DEBUG, 0, "Playlist %s was appended to.\n", playlist->filename.c_str());
+			} else {
+				from = 0;
+			}
+		}
+
+		if (!appended && !list_playlist(playlist->filename, 0, uris)) {
+			return false;
+		}
+
+		/* Unknown songs need their tags, which listplaylist does not
+		 * provide. Download everything if there are any. */
+		patched = find_songs(uris, songs);
+		if (!patched) {
+			from = 0;
+		}
 	}
 
-	playlist->clear();
+	if (!patched) {
 
-	while ((ent = mpd_recv_entity(conn->h())) != NULL)
-	{
-		switch(mpd_entity_get_type(ent))
+		pms->log(MSG_DEBUG, 0, "Retrieving playlist %s from MPD server.\n", playlist->filename.c_str());
+
+		if (!mpd_send_list_playlist_meta(conn->h(), playlist->filename.c_str())) {
+			return false;
+		}
+
+		while ((ent = mpd_recv_entity(conn->h())) != NULL)
 		{
-			case MPD_ENTITY_TYPE_SONG:
-				ent_song = mpd_entity_get_song(ent);
-				song = new Song(ent_song);
-				song->id = MPD_SONG_NO_ID;
-				song->pos = MPD_SONG_NO_NUM;
-				playlist->add_local(song);
-				break;
-			case MPD_ENTITY_TYPE_UNKNOWN:
-				pms->log(MSG_DEBUG, 0, "BUG in retrieve_lists(): entity type not implemented by libmpdclient\n");
-				break;
-			default:
-				pms->log(MSG_DEBUG, 0, "BUG in retrieve_lists(): entity type not implemented by PMS\n");
-				break;
+			switch(mpd_entity_get_type(ent))
+			{
+				case MPD_ENTITY_TYPE_SONG:
+					songs.push_back(Song::acquire(mpd_entity_get_song(ent)));
+					break;
+				case MPD_ENTITY_TYPE_UNKNOWN:
+					pms->log(MSG_DEBUG, 0, "BUG in retrieve_lists(): entity type not implemented by libmpdclient\n");
+					break;
+				default:
+					pms->log(MSG_DEBUG, 0, "BUG in retrieve_lists(): entity type not implemented by PMS\n");
+					break;
+			}
+			mpd_entity_free(ent);
+		}
+
+		if (!get_error_bool()) {
+			for (song = songs.begin(); song != songs.end(); ++song) {
+				(*song)->release();
+			}
+			return false;
 		}
-		mpd_entity_free(ent);
 	}
 
-	playlist->set_column_size();
+	changed = patch_playlist(playlist, from, songs);
 
-	return get_error_bool();
+	pms->log(MSG_DEBUG, 0, "Playlist %s has %u entries, %u of which changed.\n", playlist->filename.c_str(), playlist->size(), changed);
+
+	if (changed > 0) {
+		playlist->set_column_size();
+	}
+
+	return true;
 }
 
 /*
@@ -1469,17 +2456,11 @@ Control::update_playlist(Playlist * playlist)
 Playlist *
 Control::find_playlist(string fn)
 {
-	vector<Playlist *>::iterator	i;
+	playlistmap::iterator		i;
 
-	i = playlists.begin();
-	while (i != playlists.end()) {
-		if ((*i)->filename == fn) {
-			return *i;
-		}
-		++i;
-	}
+	i = playlist_index.find(fn);
 
-	return NULL;
+	return (i == playlist_index.end() ? NULL : i->second);
 }
 
 /*
@@ -1551,10 +2532,43 @@ bool
 Control::activatelist(Songlist * list)
 {
 	assert(list);
+	if (!require_playlist(list)) {
+		return false;
+	}
 	_active = list;
 	return true;
 }
 
+/*
+ * Make sure that the contents of a stored playlist have been retrieved.
+ * Other lists are left alone.
+ *
+ * Returns true on success, false on failure.
+ */
+bool
+Control::require_playlist(List * list)
+{
+	Playlist *	playlist;
+
+	if ((playlist = dynamic_cast<Playlist *>(list)) == NULL) {
+		return true;
+	}
+
+	playlist->set_wanted(true);
+
+	if (playlist->is_synchronized()) {
+		return true;
+	}
+
+	if (!update_playlist(playlist)) {
+		return false;
+	}
+
+	playlist->set_synchronized(true);
+
+	return true;
+}
+
 /*
  * Retrieves current playlist from MPD
  * TODO: implement missing entity types
@@ -1573,6 +2587,8 @@ Control::update_queue()
 
 	if (st->last_playlist == -1) {
 		_queue->clear();
+	} else if (commands.plchangesposid && commands.playlistid) {
+		return update_queue_positions();
 	}
 
 	if (!mpd_send_queue_changes_meta(conn->h(), st->last_playlist)) {
@@ -1585,8 +2601,8 @@ Control::update_queue()
 		{
 			case MPD_ENTITY_TYPE_SONG:
 				ent_song = mpd_entity_get_song(ent);
-				song = new Song(ent_song);
-				_queue->add_local(song);
+				song = Song::acquire(ent_song);
+				_queue->add_local(song, mpd_song_get_pos(ent_song), mpd_song_get_id(ent_song));
 				break;
 			case MPD_ENTITY_TYPE_UNKNOWN:
 				pms->log(MSG_DEBUG, 0, "BUG in update_queue(): entity type not implemented by libmpdclient\n");
@@ -1607,36 +2623,120 @@ Control::update_queue()
 }
 
 /*
- * Retrieves the currently playing song from MPD, and caches it locally.
+ * Bring the queue up to date using only the positions and ids of changed
+ * entries. Songs which are already in the queue are moved to their new
+ * positions, so a shuffle or a move does not download any tags. Songs with
+ * ids we have not seen are then retrieved one by one.
  *
  * Returns true on success, false on failure.
  */
 bool
-Control::get_current_song()
-{
-	bool status_ok;
-	struct mpd_song * song;
+Control::update_queue_positions()
+{
+	typedef unordered_map<song_t, Song *>	idmap;
+
+	struct change {
+		unsigned	pos;
+		unsigned	id;
+		Song *		song;
+	};
+
+	idmap				songs;
+	idmap::iterator			known;
+	vector<change>			changes;
+	vector<change>::iterator	iter;
+	change				c;
+	struct mpd_song *		mpd_song;
+	ListItemSong *			list_item;
+	uint32_t			i;
+	uint32_t			missing = 0;
+
+	if (!mpd_send_queue_changes_brief(conn->h(), st->last_playlist)) {
+		return false;
+	}
 
-	EXIT_IDLE;
+	while (mpd_recv_queue_change_brief(conn->h(), &c.pos, &c.id)) {
+		c.song = NULL;
+		changes.push_back(c);
+	}
+
+	if (!get_error_bool()) {
+		return false;
+	}
+
+	/* Take a reference to every song which is already in the queue,
+	 * before any of them are overwritten. */
+	songs.reserve(_queue->size());
+	for (i = 0; i < _queue->size(); i++) {
+		list_item = _queue->song_item(i);
+		songs[list_item->id] = list_item->song;
+	}
+
+	for (iter = changes.begin(); iter != changes.end(); ++iter) {
+		if ((known = songs.find(iter->id)) != songs.end()) {
+			iter->song = known->second->retain();
+		} else {
+			++missing;
+		}
+	}
+
+	/* Ask for the new songs in one go */
+	if (missing > 0) {
+		if (!mpd_command_list_begin(conn->h(), false)) {
+			goto fail;
+		}
+		for (iter = changes.begin(); iter != changes.end(); ++iter) {
+			if (iter->song == NULL && !mpd_send_get_queue_song_id(conn->h(), iter->id)) {
+				goto fail;
+			}
+		}
+		if (!mpd_command_list_end(conn->h())) {
+			goto fail;
+		}
 
-	song = mpd_run_current_song(conn->h());
-	status_ok = get_error_bool();
+		iter = changes.begin();
+		while ((mpd_song = mpd_recv_song(conn->h())) != NULL) {
+			while (iter != changes.end() && iter->song != NULL) {
+				++iter;
+			}
+			assert(iter != changes.end());
+			assert(iter->id == mpd_song_get_id(mpd_song));
+			iter->song = Song::acquire(mpd_song);
+			mpd_song_free(mpd_song);
+		}
 
-	if (!status_ok) {
-		return status_ok;
+		if (!get_error_bool()) {
+			goto fail;
+		}
 	}
 
-	if (_song != NULL) {
-		delete _song;
-		_song = NULL;
+	pms->log(MSG_DEBUG, 0, "Queue has %u changed positions, %u of which are new songs\n", changes.size(), missing);
+
+	/* Changes come in position order, so growing the queue appends */
+	for (iter = changes.begin(); iter != changes.end(); ++iter) {
+		if (iter->song == NULL) {
+			continue;
+		}
+		if (iter->pos > _queue->size()) {
+			iter->song->release();
+			continue;
+		}
+		_queue->add_local(iter->song, iter->pos, iter->id);
 	}
 
-	if (song) {
-		_song = new Song(song);
-		mpd_song_free(song);
+	_queue->truncate_local(st->playlist_length);
+	st->last_playlist = st->playlist;
+
+	return true;
+
+fail:
+	for (iter = changes.begin(); iter != changes.end(); ++iter) {
+		if (iter->song != NULL) {
+			iter->song->release();
+		}
 	}
 
-	return get_error_bool();
+	return false;
 }
 
 /*
@@ -1673,6 +2773,27 @@ Control::rescandb(string dest)
 	//return finish();
 }
 
+/*
+ * Reopen the command connection, and send the password again. All local
+ * state is kept: the IDLE connection reports what has changed in the
+ * meantime, and the updates only fetch the differences.
+ *
+ * Returns true on success, false on failure.
+ */
+bool
+Control::reconnect()
+{
+	if (conn->connect() != MPD_ERROR_SUCCESS) {
+		return false;
+	}
+
+	if (pms->options->password.size() > 0 && !mpd_run_password(conn->h(), pms->options->password.c_str())) {
+		return false;
+	}
+
+	return true;
+}
+
 /*
  * Sends a password to the mpd server
  * FIXME: should retrieve updated privileges list?
@@ -1686,7 +2807,8 @@ Control::sendpassword(string pw)
 }
 
 /**
- * Set client in IDLE mode
+ * Wait for changes on the IDLE connection. The command connection never
+ * enters IDLE mode, so commands need no extra round trips to leave it.
  */
 bool
 Control::idle()
@@ -1695,46 +2817,77 @@ Control::idle()
 		return true;
 	}
 
+	if (!_listener->connected() && !_listener->connect(pms->options->password)) {
+		pms->log(MSG_DEBUG, 0, "Could not open IDLE connection: %s\n", _listener->error().c_str());
+		return false;
+	}
+
 	pms->log(MSG_DEBUG, 0, "Entering IDLE mode.\n");
-	set_is_idle(mpd_send_idle(conn->h()));
 
-	return is_idle();
+	if (!_listener->send([this](bool ok, const Asyncclient::response & pairs, const string & error) {
+			Asyncclient::response::const_iterator	iter;
+			int					events = 0;
+
+			if (!ok) {
+				/* Changes may have been missed while the
+				 * connection was down */
+				pms->log(MSG_DEBUG, 0, "IDLE failed: %s\n", error.c_str());
+				set_mpd_idle_events((enum mpd_idle) 0xffffffff);
+				return;
+			}
+
+			for (iter = pairs.begin(); iter != pairs.end(); ++iter) {
+				if (iter->first == "changed") {
+					events |= mpd_idle_name_parse(iter->second.c_str());
+				}
+			}
+
+			set_mpd_idle_events((enum mpd_idle) events);
+		}, "idle", NULL)) {
+		return false;
+	}
+
+	/* Queuing does no I/O, so send the command right away. Whatever does
+	 * not fit in the socket is written when the main loop finds it
+	 * writable. */
+	return run_idle(false, true);
 }
 
 /**
- * Take client out of IDLE mode
+ * Dispatch a reply on the IDLE connection.
+ *
+ * Returns false if the connection failed.
  */
 bool
-Control::noidle()
+Control::run_idle(bool readable, bool writable)
 {
-	if (!is_idle()) {
-		return true;
+	if (!_listener->connected()) {
+		return false;
 	}
 
-	pms->log(MSG_DEBUG, 0, "Leaving IDLE mode.\n");
-	set_is_idle(mpd_send_noidle(conn->h()));
-
-	return is_idle();
+	return _listener->run(readable, writable);
 }
 
 /**
- * Block until MPD is ready to receieve requests.
+ * True if the IDLE command has not been completely sent yet.
  */
 bool
-Control::wait_until_noidle()
+Control::idle_wants_write()
 {
-	pms->poll_events(NOIDLE_POLL_TIMEOUT);
-	return pms->run_has_idle_events();
+	return _listener->wants_write();
 }
 
+/**
+ * True while waiting for changes on the IDLE connection.
+ */
 bool
 Control::is_idle()
 {
-	return _is_idle;
+	return (_listener->size() > 0);
 }
 
-void
-Control::set_is_idle(bool i)
+int
+Control::get_idle_file_descriptor()
 {
-	_is_idle = i;
+	return _listener->get_file_descriptor();
 }
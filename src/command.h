@@ -21,13 +21,18 @@
 #ifndef _PMS_COMMAND_H_
 #define _PMS_COMMAND_H_
 
+#include <functional>
 #include <string>
+#include <unordered_map>
 #include <time.h>
 #include <mpd/client.h>
 
+#include "async.h"
 #include "conn.h"
+#include "fetcher.h"
 #include "songlist.h"
 #include "playlist.h"
+#include "library.h"
 
 using namespace std;
 
@@ -167,6 +172,7 @@ public:
 	song_t		albums_count;
 	song_t		songs_count;
 	unsigned long	uptime;
+	time_t		uptime_sampled;
 	unsigned long	db_update_time;
 	unsigned long	playtime;
 	unsigned long	db_playtime;
@@ -185,8 +191,13 @@ public:
 class Directory
 {
 private:
+	typedef unordered_map<string, Directory *>	childmap;
+
 	Directory *			parent_;
 	string				name_;
+	string				path_;
+	childmap			index;
+
 public:
 					Directory(Directory *, string);
 					~Directory();
@@ -194,10 +205,29 @@ public:
 	int				cursor;
 	vector<Song *>			songs;
 	vector<Directory *>		children;
-	Directory *			add(string);
+
+	/**
+	 * Return the directory at a path relative to this one, creating it
+	 * and any missing parents. If a directory close to the wanted one is
+	 * given as 'hint', the search starts from the nearest ancestor of
+	 * 'hint' instead of from the top. This makes adding the directories
+	 * of a depth-first listing cost one lookup each.
+	 */
+	Directory *			add(const string & path, Directory * hint = NULL);
+
+	/**
+	 * Return the immediate subdirectory with the given name, or NULL.
+	 */
+	Directory *			child(const string & name);
+
+	/**
+	 * Remove all songs and subdirectories.
+	 */
+	void				clear();
+
 	string				name() { return (name_.size() == 0 ? "/" : name_); };
 	Directory *			parent() { return parent_; };
-	string				path();
+	const string &			path() { return path_; };
 
 //	void				debug_tree();
 };
@@ -212,29 +242,60 @@ private:
 	Connection *		conn;
 	Mpd_status *		st;
 	Mpd_allowed_commands	commands;
-	bool			_is_idle;
 
 	Song			*_song;
+	song_t			_song_pos;
+	song_t			_song_id;
 	Songlist		*_queue;
-	Songlist		*_library;
+	Library			*_library;
 	Songlist		*_active;
 
+	/* Stored playlists by file name */
+	typedef unordered_map<string, Playlist *>	playlistmap;
+	playlistmap		playlist_index;
+
 	long long		last_playlist_version;
-	int			command_mode;
 	int			mutevolume;
 	int			crossfadetime;
 
+	/* Connection for commands which do not return anything */
+	Asyncclient *		_async;
+
+	/* Connection which stays in IDLE mode, waiting for changes */
+	Asyncclient *		_listener;
+
+	/* State of a library download in progress */
+	Fetcher *		_fetcher;
+	bool			_library_loading;
+	bool			_library_progressive;
+	uint32_t		_library_received;
+	Directory *		_library_dir;
+	vector<Song *>		_library_pending;
+	struct timespec		_library_started;
+	unsigned long		_library_db_update_time;
+
+	/* Database update time of the library in the on-disk cache */
+	unsigned long		_library_cache_time;
+
 	/* Flags denoting outdated information, for use in IDLE */
 	uint32_t		idle_events;
 	uint32_t		finished_idle_events;
 
-	bool			get_current_song();
-	int			get_stats();
+	bool			refresh_status(bool current_song, bool stats);
+	bool			async_ready();
 	bool			update_playlist_index();
 	bool			update_playlists();
 	bool			update_playlist(Playlist *);
+	bool			list_playlist(const string & filename, uint32_t from, vector<string> & uris);
 	bool			update_queue();
+	bool			update_queue_positions();
 	bool			update_library();
+	bool			start_library_download(bool background);
+	void			discard_library_download();
+	bool			receive_library(uint32_t limit);
+	bool			sync_library(unsigned long since);
+	void			rebuild_directories();
+	bool			load_library_cache(unsigned long * db_update_time);
 	bool			finish();
 
 public:
@@ -260,27 +321,33 @@ public:
 	bool			get_error_bool();
 
 	/**
-	 * Exit IDLE mode.
+	 * Make the command connection ready for a new command. This waits
+	 * for a library download on it, and for commands sent on the
+	 * asynchronous connection.
 	 *
 	 * Returns true on success, false on failure.
 	 */
 	bool			exit_idle();
 
 	/* Server management */
+	bool			reconnect();
 	int			authlevel();
 	bool			get_available_commands();
 	bool			rescandb(string = "/");
 	bool			sendpassword(string);
 	void			clearerror();
+	bool			save_library_cache();
 
-	/* Set/end command list mode */
-	bool			list_start();
-	bool			list_end();
+	/* Send many commands in command lists */
+	typedef function<bool(uint32_t)>	command_function;
+	bool			run_command_lists(uint32_t count, const command_function & send, const command_function & receive, vector<bool> & succeeded);
 
 	/* List management */
 	song_t			add(Songlist *, Song *);
 	song_t			add(Songlist * source, Songlist * dest);
-	bool			remove(Songlist *, Song *);
+	song_t			add(Songlist * list, const vector<Song *> & songs, vector<bool> & succeeded);
+	bool			remove(Songlist *, ListItemSong *);
+	bool			remove(Songlist * list, const vector<ListItemSong *> & items, vector<bool> & succeeded);
 
 	/* Play controls */
 	bool			play();
@@ -302,12 +369,27 @@ public:
 	bool			muted();
 	int			mvolume() { return mutevolume; };
 
-	/* IDLE management */
+	/* IDLE management, on a connection of its own */
 	bool			idle();
-	bool			noidle();
-	bool			wait_until_noidle();
 	bool			is_idle();
-	void			set_is_idle(bool);
+	bool			run_idle(bool readable, bool writable);
+	bool			idle_wants_write();
+	int			get_idle_file_descriptor();
+
+	/* True while the library is being downloaded in chunks */
+	bool			library_loading() { return _library_loading; };
+
+	/* True while the main connection is busy downloading the library */
+	bool			connection_busy() { return _library_loading && _fetcher == NULL; };
+
+	/* File descriptor of a background library download, or -1 */
+	int			get_fetcher_file_descriptor();
+
+	/* Asynchronous command connection, polled by the main loop */
+	int			get_async_file_descriptor();
+	bool			async_wants_write();
+	bool			run_async(bool readable, bool writable);
+	void			reset_async();
 
 	/* List management */
 	Playlist *		find_playlist(string filename);
@@ -316,6 +398,7 @@ public:
 	bool			delete_playlist(string name);
 	Songlist *	activelist();
 	bool		activatelist(Songlist *);
+	bool		require_playlist(List *);
 	int		clear(Songlist *);
 	unsigned int	move(Songlist *, int offset);
 
@@ -326,6 +409,8 @@ public:
 
 	Mpd_status	*status() { return st; };
 	Song		*song() { return _song; };
+	song_t		song_pos() { return _song_pos; };
+	song_t		song_id() { return _song_id; };
 	Songlist	*queue() { return _queue; };
 	Songlist	*library() { return _library; };
 
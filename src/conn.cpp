@@ -22,6 +22,7 @@
  */
 
 #include <mpd/client.h>
+#include <poll.h>
 
 #include "conn.h"
 #include "pms.h"
@@ -103,11 +104,31 @@ Connection::disconnect()
 	mpd_connection_free(handle);
 	handle = NULL;
 	fd = -1;
-	pms->comm->set_is_idle(false);
 
 	return false;
 }
 
+/**
+ * Returns true if the server has closed the connection while it was not in
+ * use. Must only be called when no response is expected, since any data on
+ * the socket then means that the connection is gone.
+ */
+bool
+Connection::stale()
+{
+	struct pollfd p;
+
+	if (handle == NULL || fd == -1) {
+		return false;
+	}
+
+	p.fd = fd;
+	p.events = POLLIN;
+	p.revents = 0;
+
+	return (poll(&p, 1, 0) > 0);
+}
+
 /**
  * Return the file descriptor to the MPD socket.
  */
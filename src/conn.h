@@ -49,6 +49,7 @@ public:
 	int		connect();
 	bool		disconnect();
 	bool		clear_error();
+	bool		stale();
 	int		get_mpd_file_descriptor();
 };
  
@@ -24,6 +24,7 @@
 #include "display.h"
 #include "config.h"
 #include "pms.h"
+#include <algorithm>
 #include <cstdio>
 #include <sstream>
 
@@ -270,6 +271,7 @@ void
 Display::add_list(List * list)
 {
 	lists.push_back(list);
+	titles.insert(make_pair(string(list->title()), list));
 	list->set_bounding_box(&main_window);
 }
 
@@ -282,6 +284,9 @@ Display::activate_list(List * list)
 		return false;
 	}
 
+	/* Stored playlists are retrieved when first shown */
+	pms->comm->require_playlist(list);
+
 	last_list = active_list;
 	active_list = list;
 
@@ -296,19 +301,53 @@ Display::activate_list(List * list)
 void
 Display::remove_list(List * list)
 {
-	vector<List *>::iterator it;
-
 	assert(list);
 
-	for (it = lists.begin(); it != lists.end(); it++) {
-		if (*it == list) {
-			lists.erase(it);
-			return;
+	remove_lists(vector<List *>(1, list));
+}
+
+void
+Display::remove_lists(const vector<List *> & removed)
+{
+	unordered_set<List *>			gone(removed.begin(), removed.end());
+	vector<List *>::iterator		kept;
+	vector<List *>::iterator		it;
+	vector<List *>::const_iterator		list;
+	unordered_map<string, List *>::iterator	title;
+	bool					retitle = false;
+
+	if (gone.empty()) {
+		return;
+	}
+
+	/* Drop the lists by moving the remaining ones down */
+	kept = lists.begin();
+	for (it = lists.begin(); it != lists.end(); ++it) {
+		if (!gone.count(*it)) {
+			*kept++ = *it;
 		}
 	}
 
-	/* BUG: list should be here */
-	assert(false);
+	/* BUG: all lists should be here */
+	assert((size_t)(lists.end() - kept) == gone.size());
+
+	lists.erase(kept, lists.end());
+
+	for (list = removed.begin(); list != removed.end(); ++list) {
+		title = titles.find((*list)->title());
+		if (title != titles.end() && title->second == *list) {
+			titles.erase(title);
+			retitle = true;
+		}
+	}
+
+	/* Let another list with the same title take the place of a removed
+	 * one. Titles that are still present are left alone by insert(). */
+	if (retitle) {
+		for (it = lists.begin(); it != lists.end(); ++it) {
+			titles.insert(make_pair(string((*it)->title()), *it));
+		}
+	}
 }
 
 List *
@@ -354,17 +393,11 @@ Display::previous_list()
 List *
 Display::find(const char * title)
 {
-	vector<List *>::iterator i;
+	unordered_map<string, List *>::iterator i;
 
-	i = lists.begin();
-	while (i != lists.end()) {
-		if (!strcmp(title, (*i)->title())) {
-			return *i;
-		}
-		++i;
-	}
+	i = titles.find(title);
 
-	return NULL;
+	return (i == titles.end() ? NULL : i->second);
 }
 
 bool
@@ -24,6 +24,8 @@
 #include <cmath>
 #include <cstdlib>
 #include <string>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include "mycurses.h"
@@ -97,6 +99,9 @@ class Display
 private:
 	vector<List *>		lists;
 
+	/* Lists by title. Holds the first list added with any given title. */
+	unordered_map<string, List *>	titles;
+
 	mmask_t			oldmmask;
 	mmask_t			mmask;
 
@@ -132,6 +137,11 @@ public:
 	 */
 	void			remove_list(List * list);
 
+	/**
+	 * Remove several Lists from the collection of lists in a single pass.
+	 */
+	void			remove_lists(const vector<List *> & removed);
+
 	/**
 	 * @return List* The next list of all lists. Wraps around if the active
 	 * list is the last in series.
@@ -0,0 +1,251 @@
+/* vi:set ts=8 sts=8 sw=8 noet:
+ *
+ * PMS	<<Practical Music Search>>
+ * Copyright (C) 2006-2015  Kim Tore Jensen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * fetcher.cpp
+ * 	downloads the song library on a separate connection and thread
+ */
+
+
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "fetcher.h"
+
+/* Number of entities handed over to the main thread at a time */
+#define FETCHER_BATCH_SIZE	256
+
+/* Number of entities the queue holds before the worker waits for room */
+#define FETCHER_QUEUE_LIMIT	8192
+
+
+Fetcher::Fetcher(const string & n_host, long n_port, long n_timeout_ms, const string & n_password)
+{
+	host = n_host;
+	port = static_cast<unsigned int>(n_port);
+	timeout_ms = static_cast<unsigned int>(n_timeout_ms);
+	password = n_password;
+	started_ = false;
+	done_ = false;
+	cancel_ = false;
+	fds[0] = -1;
+	fds[1] = -1;
+
+	pthread_mutex_init(&mutex, NULL);
+	pthread_cond_init(&room, NULL);
+}
+
+Fetcher::~Fetcher()
+{
+	deque<struct mpd_entity *>::iterator	iter;
+
+	if (started_) {
+		pthread_mutex_lock(&mutex);
+		cancel_ = true;
+		pthread_cond_signal(&room);
+		pthread_mutex_unlock(&mutex);
+		pthread_join(thread, NULL);
+	}
+
+	for (iter = queue.begin(); iter != queue.end(); ++iter) {
+		mpd_entity_free(*iter);
+	}
+
+	if (fds[0] != -1) {
+		close(fds[0]);
+		close(fds[1]);
+	}
+
+	pthread_cond_destroy(&room);
+	pthread_mutex_destroy(&mutex);
+}
+
+bool
+Fetcher::start()
+{
+	assert(!started_);
+
+	if (pipe(fds) != 0) {
+		fds[0] = -1;
+		fds[1] = -1;
+		return false;
+	}
+
+	fcntl(fds[0], F_SETFL, O_NONBLOCK);
+	fcntl(fds[1], F_SETFL, O_NONBLOCK);
+
+	if (pthread_create(&thread, NULL, &Fetcher::run, this) != 0) {
+		return false;
+	}
+
+	started_ = true;
+
+	return true;
+}
+
+void *
+Fetcher::run(void * data)
+{
+	static_cast<Fetcher *>(data)->fetch();
+
+	return NULL;
+}
+
+/*
+ * Worker thread body. Connects, lists the whole database, and hands the
+ * entities over in batches.
+ */
+void
+Fetcher::fetch()
+{
+	struct mpd_connection *		c;
+	struct mpd_entity *		ent;
+	vector<struct mpd_entity *>	batch;
+	bool				cancelled = false;
+	string				error;
+
+	c = mpd_connection_new(host.c_str(), port, timeout_ms);
+
+	if (c != NULL && mpd_connection_get_error(c) == MPD_ERROR_SUCCESS &&
+	    (password.empty() || mpd_run_password(c, password.c_str())) &&
+	    mpd_send_list_all_meta(c, "")) {
+
+		batch.reserve(FETCHER_BATCH_SIZE);
+
+		while (!cancelled && (ent = mpd_recv_entity(c)) != NULL) {
+			batch.push_back(ent);
+			if (batch.size() == FETCHER_BATCH_SIZE) {
+				cancelled = !push(batch);
+			}
+		}
+	}
+
+	if (c == NULL) {
+		error = "out of memory";
+	} else if (mpd_connection_get_error(c) != MPD_ERROR_SUCCESS) {
+		error = mpd_connection_get_error_message(c);
+	}
+
+	push(batch);
+
+	pthread_mutex_lock(&mutex);
+	error_ = error;
+	done_ = true;
+	wakeup();
+	pthread_mutex_unlock(&mutex);
+
+	if (c != NULL) {
+		mpd_connection_free(c);
+	}
+}
+
+/*
+ * Append a batch of entities to the queue, and empty the batch. Waits while
+ * the queue is full.
+ *
+ * Returns false if the download was cancelled, in which case the batch is
+ * freed instead.
+ */
+bool
+Fetcher::push(vector<struct mpd_entity *> & entities)
+{
+	vector<struct mpd_entity *>::iterator	iter;
+	bool					cancelled;
+
+	pthread_mutex_lock(&mutex);
+
+	while (!cancel_ && !entities.empty() && queue.size() >= FETCHER_QUEUE_LIMIT) {
+		pthread_cond_wait(&room, &mutex);
+	}
+
+	cancelled = cancel_;
+
+	if (!cancelled && !entities.empty()) {
+		if (queue.empty()) {
+			wakeup();
+		}
+		queue.insert(queue.end(), entities.begin(), entities.end());
+	}
+
+	pthread_mutex_unlock(&mutex);
+
+	if (cancelled) {
+		for (iter = entities.begin(); iter != entities.end(); ++iter) {
+			mpd_entity_free(*iter);
+		}
+	}
+
+	entities.clear();
+
+	return !cancelled;
+}
+
+/*
+ * Make the read end of the pipe readable. Called with the mutex held.
+ */
+void
+Fetcher::wakeup()
+{
+	char	c = 0;
+
+	if (write(fds[1], &c, 1) == -1) {
+		/* Pipe is full, so it is readable already */
+	}
+}
+
+bool
+Fetcher::take(vector<struct mpd_entity *> & out, size_t limit)
+{
+	char	buffer[64];
+	bool	finished;
+	size_t	count;
+
+	pthread_mutex_lock(&mutex);
+
+	count = (limit == 0 || queue.size() < limit ? queue.size() : limit);
+	out.insert(out.end(), queue.begin(), queue.begin() + count);
+	queue.erase(queue.begin(), queue.begin() + count);
+
+	if (count > 0) {
+		pthread_cond_signal(&room);
+	}
+
+	/* Keep the pipe readable for as long as there is anything to take */
+	if (queue.empty() && !done_) {
+		while (read(fds[0], buffer, sizeof(buffer)) > 0);
+	}
+
+	finished = (done_ && queue.empty());
+
+	pthread_mutex_unlock(&mutex);
+
+	return finished;
+}
+
+string
+Fetcher::error()
+{
+	string	e;
+
+	pthread_mutex_lock(&mutex);
+	e = error_;
+	pthread_mutex_unlock(&mutex);
+
+	return e;
+}
@@ -0,0 +1,113 @@
+/* vi:set ts=8 sts=8 sw=8 noet:
+ *
+ * PMS	<<Practical Music Search>>
+ * Copyright (C) 2006-2015  Kim Tore Jensen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * fetcher.h
+ * 	downloads the song library on a separate connection and thread
+ */
+
+
+#ifndef _PMS_FETCHER_H_
+#define _PMS_FETCHER_H_
+
+#include <deque>
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include <mpd/client.h>
+
+using namespace std;
+
+
+/**
+ * Downloads the song library from MPD in a worker thread, using a connection
+ * of its own. The main connection stays free for playback control while the
+ * download is in progress.
+ *
+ * The worker only receives entities from libmpdclient; it never touches songs,
+ * tags or lists, which belong to the main thread. Received entities are
+ * queued, and picked up by the main thread with take(). A byte is written to
+ * a pipe whenever the queue becomes non-empty, so that the main loop can poll
+ * for it together with its other file descriptors.
+ *
+ * The queue is bounded. When it is full, the worker waits for the main thread
+ * to take from it, so that at most a few batches of raw entities are held in
+ * memory at any time.
+ */
+class Fetcher
+{
+private:
+	string				host;
+	unsigned int			port;
+	unsigned int			timeout_ms;
+	string				password;
+
+	pthread_t			thread;
+	pthread_mutex_t			mutex;
+	pthread_cond_t			room;
+	bool				started_;
+
+	/* Protected by mutex */
+	deque<struct mpd_entity *>	queue;
+	bool				done_;
+	bool				cancel_;
+	string				error_;
+
+	/* Wakeup pipe, read end first */
+	int				fds[2];
+
+	static void *			run(void *);
+	void				fetch();
+	bool				push(vector<struct mpd_entity *> & entities);
+	void				wakeup();
+
+public:
+					Fetcher(const string & host, long port, long timeout_ms, const string & password);
+					~Fetcher();
+
+	/**
+	 * Start the download.
+	 *
+	 * Returns true if the worker thread was started, false otherwise.
+	 */
+	bool				start();
+
+	/**
+	 * Move up to 'limit' received entities to the end of 'out', or all of
+	 * them if 'limit' is zero. The caller
+	 * owns them, and must free them with mpd_entity_free().
+	 *
+	 * Returns true when the download has ended and every entity has been
+	 * taken, false if there is more to come.
+	 */
+	bool				take(vector<struct mpd_entity *> & out, size_t limit);
+
+	/**
+	 * Error message from a failed download, or an empty string if the
+	 * download succeeded. Only meaningful after take() has returned true.
+	 */
+	string				error();
+
+	/**
+	 * File descriptor which becomes readable when there are entities to
+	 * take. Must only be used for polling!
+	 */
+	int				get_file_descriptor() { return fds[0]; };
+};
+
+#endif /* _PMS_FETCHER_H_ */
@@ -391,8 +391,9 @@ string			Formatter::format(Song * song, Item keyword, unsigned int & printlen, c
 		/* Field types */
 
 		case FIELD_NUM:
-			if (!song) return retstr;
-			retstr = Pms::tostring(song->pos);
+			/* Only the playing song has a position outside of a list */
+			if (!song || song != pms->cursong()) return retstr;
+			retstr = Pms::tostring(pms->cursong_pos());
 			break;
 
 		case FIELD_FILE:
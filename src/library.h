@@ -37,6 +37,13 @@ public:
 	 * Always returns false.
 	 */
 	bool			remove(ListItem * i);
+	bool			remove_items(const vector<ListItem *> & items) { return List::remove_items(items); };
+
+	/**
+	 * Drop songs which are no longer in the MPD database, given by their
+	 * positions in strictly ascending order.
+	 */
+	void			remove_gone(const vector<uint32_t> & positions) { remove_local(positions); };
 };
 
 #endif /* _PMS_LIBRARY_H_ */
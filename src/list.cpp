@@ -19,6 +19,7 @@
 
 #include <stdlib.h>
 #include <assert.h>
+#include <algorithm>
 
 #include "display.h"
 #include "list.h"
@@ -53,23 +54,50 @@ List::init()
 void
 List::remove_local(uint32_t position)
 {
-	vector<ListItem *>::iterator iter;
+	remove_local(vector<uint32_t>(1, position));
+}
+
+void
+List::remove_local(const vector<uint32_t> & positions)
+{
+	vector<ListItem *>::iterator		dest;
+	vector<uint32_t>::const_iterator	pos;
+	uint32_t				i;
 
-	assert(position >= 0);
-	assert(position < size());
+	if (positions.empty()) {
+		return;
+	}
+
+	assert(positions.back() < size());
+
+	/* Delete the removed items and move the remaining ones down */
+	pos = positions.begin();
+	dest = items.begin() + *pos;
 
-	iter = items.begin() + position;
-	assert(iter != items.end());
-	assert(*iter);
+	for (i = *pos; i < size(); i++) {
+		if (pos != positions.end() && *pos == i) {
+			assert(items[i]);
+			items[i]->set_selected(false);
+			delete items[i];
+			++pos;
+			assert(pos == positions.end() || *pos > i);
+			continue;
+		}
+		*dest++ = items[i];
+	}
 
-	(*iter)->set_selected(false);
-	delete *iter;
-	items.erase(iter);
+	items.erase(dest, items.end());
 
 	if (cursor_position >= size()) {
 		set_cursor(size() - 1);
 	}
 
+	items_changed();
+}
+
+void
+List::items_changed()
+{
 	set_selection_cache_valid(false);
 }
 
@@ -96,12 +124,12 @@ List::crop_to_selection()
 }
 
 bool
-List::remove_selection()
+List::remove_items(const vector<ListItem *> & items)
 {
-	vector<ListItem *>::reverse_iterator iter;
+	vector<ListItem *>::const_reverse_iterator iter;
 
-	iter = selection_rbegin();
-	while (iter != selection_rend()) {
+	iter = items.rbegin();
+	while (iter != items.rend()) {
 		if (!remove(*iter)) {
 			return false;
 		}
@@ -111,56 +139,62 @@ List::remove_selection()
 	return true;
 }
 
+bool
+List::remove_selection()
+{
+	/* Copy the selection, as removing items invalidates it */
+	return remove_items(vector<ListItem *>(selection_begin(), selection_end()));
+}
+
 
 /*
  * Move a list item inside the list to position dest
  */
-bool
-List::move(uint32_t from, uint32_t to)
+void
+List::move_local(const vector<uint32_t> & positions, int32_t offset)
 {
-/*
-	ListItem * tmp;
-	vector<ListItem *>::iterator from_iter;
-	vector<ListItem *>::iterator to_iter;
-
-	assert(from < size());
-	assert(to < size());
-	assert(from != to);
-
-	from_iter = items.begin() + from;
-	to_iter = items.begin() + to;
+	vector<ListItem *>			result;
+	vector<uint32_t>::const_iterator	pos;
+	uint32_t				first;
+	uint32_t				last;
+	uint32_t				i;
+	uint32_t				j;
 
-	assert(from_iter != items.end());
-	assert(to_iter != items.end());
+	if (positions.empty() || offset == 0) {
+		return;
+	}
 
-	tmp = *from_iter;
+	assert((int32_t)positions.front() + offset >= 0);
+	assert(positions.back() + offset < size());
 
-	// Set direction FIXME
-	if (dst == songpos)
-		return false;
-	else if (dst > songpos)
-		direction = 1;
-	else
-		direction = -1;
+	/* Only the span from the first source to the last destination, or
+	 * the other way around, is rearranged */
+	first = (offset < 0 ? positions.front() + offset : positions.front());
+	last = (offset < 0 ? positions.back() : positions.back() + offset);
 
-	// Swap every element on its way
-	while (songpos != dst)
-	{
-		if (!this->swap(songpos, (songpos + direction)))
-			return false;
+	result.assign(last - first + 1, NULL);
 
-		songpos += direction;
+	for (pos = positions.begin(); pos != positions.end(); ++pos) {
+		result[*pos + offset - first] = items[*pos];
 	}
 
-	// Clear queue length
-	{
-		qlen = 0;
-		qpos = 0;
-		qnum = 0;
-		qsize = 0;
+	/* Fill the gaps with the other items, in order */
+	pos = positions.begin();
+	j = 0;
+	for (i = first; i <= last; i++) {
+		if (pos != positions.end() && *pos == i) {
+			++pos;
+			continue;
+		}
+		while (result[j] != NULL) {
+			++j;
+		}
+		result[j] = items[i];
 	}
-	*/
-	return true;
+
+	std::copy(result.begin(), result.end(), items.begin() + first);
+
+	items_changed();
 }
 
 ListItem *
@@ -376,6 +410,7 @@ List::clear()
 	items.clear();
 
 	init();
+	items_changed();
 }
 
 ListItem *
@@ -86,6 +86,27 @@ protected:
 	 */
 	void				remove_local(uint32_t position);
 
+	/**
+	 * Remove the items at a set of positions, given in strictly ascending
+	 * order, in a single pass over the list.
+	 */
+	void				remove_local(const vector<uint32_t> & positions);
+
+	/**
+	 * Move the items at a set of positions, given in strictly ascending
+	 * order, by 'offset' places. The other items keep their relative
+	 * order and fill the remaining places. All destinations must be
+	 * inside the list.
+	 */
+	void				move_local(const vector<uint32_t> & positions, int32_t offset);
+
+	/**
+	 * Called whenever items are added, removed or reordered. Subclasses
+	 * keeping derived data about the items can override this to
+	 * invalidate it.
+	 */
+	virtual void			items_changed();
+
 public:
 					List();
 
@@ -130,6 +151,15 @@ public:
 	 */
 	virtual bool			remove(ListItem * i) = 0;
 
+	/**
+	 * Remove several items from the remote list. The default
+	 * implementation calls remove() for each item, from the last one to
+	 * the first.
+	 *
+	 * Returns true on success, false on failure.
+	 */
+	virtual bool			remove_items(const vector<ListItem *> & items);
+
 	/**
 	 * Crop the list to the list selection.
 	 *
@@ -155,7 +185,7 @@ public:
 	 *
 	 * Returns a ListItem pointer if a match was found, or NULL if no match.
 	 */
-	ListItem *			match(string pattern, unsigned int from, unsigned int to, long flags);
+	virtual ListItem *		match(string pattern, unsigned int from, unsigned int to, long flags);
 
 	/**
 	 * Find matching ListItem, starting from after the cursor position,
@@ -248,9 +278,6 @@ public:
 	 */
 	void				set_title(string new_title);
 
-	/* FIXME: needed? */
-	bool				move(uint32_t, uint32_t);
-
 	/**
 	 * Returns an iterator to the start of the item list.
 	 */
@@ -312,4 +339,24 @@ public:
 };
 
 
+/**
+ * List which only holds items of type T. Items can be accessed as T without
+ * runtime type checks, since subclasses only ever add items of that type.
+ */
+template <class T>
+class TypedList : public List
+{
+protected:
+	/**
+	 * Return `it` as a T *. The item must belong to this list.
+	 */
+	static T *			typed(ListItem * it) { return static_cast<T *>(it); };
+
+public:
+	/**
+	 * Return the item at position N as a T *, or NULL if out of bounds.
+	 */
+	T *				typed_item(uint32_t index) { return static_cast<T *>(item(index)); };
+};
+
 #endif /* _PMS_LIST_H_ */
@@ -238,12 +238,14 @@ Options::Options()
 	NEW_BOOL(followplayback);
 	NEW_BOOL(followwindow);
 	NEW_BOOL_GROUPED(ignorecase, OPT_GROUP_SORT);
+	NEW_BOOL(librarycache);
 	NEW_BOOL(mouse);
 	NEW_BOOL(nextafteraction);
 	NEW_BOOL(regexsearch);
 	NEW_BOOL_GROUPED(topbarborders, OPT_GROUP_DISPLAY);
 	NEW_BOOL_GROUPED(topbarvisible, OPT_GROUP_DISPLAY);
 
+	NEW_LONG(commandlistsize);
 	NEW_LONG(crossfade);
 	NEW_LONG_GROUPED(mpd_timeout, OPT_GROUP_CONNECTION);
 	NEW_LONG(msg_buffer_size);
@@ -297,6 +299,7 @@ Options::reset()
 	addtoreturns = false;
 	columnborders = false;
 	columns = "artist track title album length";
+	commandlistsize = 500;
 	crossfade = 5;
 	debug = false;
 	followcursor = false;
@@ -304,6 +307,7 @@ Options::reset()
 	followwindow = false;
 	host = "localhost";
 	ignorecase = true;
+	librarycache = true;
 	libraryroot = "";
 	mouse = false;
 	mpd_timeout = 2;
@@ -201,6 +201,7 @@ public:
 	/* FIXME: refactor this elsewhere */
 	string			configfile;
 
+	long			commandlistsize;
 	long			crossfade;
 	long			mpd_timeout;
 	long			msg_buffer_size;
@@ -217,6 +218,7 @@ public:
 	bool			followplayback;
 	bool			followwindow;
 	bool			ignorecase;
+	bool			librarycache;
 	bool			mouse;
 	bool			nextafteraction;
 	bool			regexsearch;
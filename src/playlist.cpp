@@ -30,6 +30,7 @@ Playlist::Playlist()
 	_last_modified = 0;
 	_synchronized = false;
 	_exists_in_mpd = true;
+	_wanted = false;
 }
 
 /**
@@ -59,7 +60,8 @@ Playlist::assign_metadata_from_mpd(mpd_playlist * playlist)
 	_last_modified = mpd_playlist_get_last_modified(playlist);
 	_exists_in_mpd = true;
 
-	if (_last_modified > last_mod) {
+	/* Any change counts: a playlist may be replaced by an older copy */
+	if (_last_modified != last_mod) {
 		_synchronized = false;
 	}
 }
@@ -102,10 +104,46 @@ Playlist::set_exists_in_mpd(bool exists)
 	_exists_in_mpd = exists;
 }
 
+/**
+ * Return true if the contents of this playlist are needed, false if not.
+ */
+bool
+Playlist::is_wanted()
+{
+	return _wanted;
+}
+
+/**
+ * Set whether the contents of this playlist are needed.
+ */
+void
+Playlist::set_wanted(bool wanted)
+{
+	_wanted = wanted;
+}
+
 bool
 Playlist::remove(ListItem * i)
 {
 	ListItemSong * item_song = LISTITEMSONG(i);
 	assert(item_song->song);
-	return mpd_run_playlist_delete(pms->conn->h(), _filename.c_str(), item_song->song->pos);
+	return mpd_run_playlist_delete(pms->conn->h(), _filename.c_str(), item_song->pos);
+}
+
+/*
+ * Remove many songs in as few round trips as possible.
+ */
+bool
+Playlist::remove_items(const vector<ListItem *> & items)
+{
+	vector<ListItemSong *>	songs;
+	vector<bool>		succeeded;
+	vector<ListItem *>::const_iterator iter;
+
+	songs.reserve(items.size());
+	for (iter = items.begin(); iter != items.end(); ++iter) {
+		songs.push_back(LISTITEMSONG(*iter));
+	}
+
+	return pms->comm->remove(this, songs, succeeded);
 }
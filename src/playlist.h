@@ -37,6 +37,7 @@ private:
 	time_t			_last_modified;
 	bool			_synchronized;
 	bool			_exists_in_mpd;
+	bool			_wanted;
 	string			_filename;
 
 public:
@@ -54,12 +55,21 @@ public:
 	bool			exists_in_mpd();
 	void			set_exists_in_mpd(bool exists);
 
+	/**
+	 * Playlist contents are only retrieved from MPD once they are needed,
+	 * i.e. when the list is shown or used for playback. Until then the
+	 * playlist is an empty placeholder.
+	 */
+	bool			is_wanted();
+	void			set_wanted(bool wanted);
+
 	/**
 	 * Remove a song within this playlist from the MPD version.
 	 *
 	 * Returns true on success, false on failure.
 	 */
 	bool			remove(ListItem * i);
+	bool			remove_items(const vector<ListItem *> & items);
 };
 
 #endif /* _PMS_PLAYLIST_H_ */
@@ -144,6 +144,7 @@ Pms::Pms(int c, char **v)
 	argc = c;
 	argv = v;
 	disp = NULL;
+	reconnect_attempts = 0;
 }
 
 /*
@@ -176,39 +177,68 @@ Pms::poll_events(long timeout_ms)
 {
 	struct timeval timeout;
 	int mpd_fd;
+	int fetcher_fd;
+	int async_fd;
 	int nfds;
 	int rc;
 
-	if ((mpd_fd = conn->get_mpd_file_descriptor()) != -1) {
+	FD_ZERO(&poll_write_descriptors);
+
+	/* IDLE replies arrive on a connection of their own, and the IDLE
+	 * command itself may still be waiting to be sent */
+	if ((mpd_fd = comm->get_idle_file_descriptor()) != -1) {
 		FD_SET(mpd_fd, &poll_file_descriptors);
+		if (comm->idle_wants_write()) {
+			FD_SET(mpd_fd, &poll_write_descriptors);
+		}
+	}
+
+	/* Wake up when a background library download has data */
+	if ((fetcher_fd = comm->get_fetcher_file_descriptor()) != -1) {
+		FD_SET(fetcher_fd, &poll_file_descriptors);
+	}
+
+	/* Responses to asynchronous commands, and room for more of them */
+	if ((async_fd = comm->get_async_file_descriptor()) != -1) {
+		FD_SET(async_fd, &poll_file_descriptors);
+		if (comm->async_wants_write()) {
+			FD_SET(async_fd, &poll_write_descriptors);
+		}
 	}
 
 	FD_SET(STDIN_FILENO, &poll_file_descriptors);
 
 	nfds = STDIN_FILENO > mpd_fd ? STDIN_FILENO : mpd_fd;
+	nfds = nfds > fetcher_fd ? nfds : fetcher_fd;
+	nfds = nfds > async_fd ? nfds : async_fd;
 
 	timeout.tv_sec = timeout_ms / 1000;
 	timeout.tv_usec = (timeout_ms * 1000) - (timeout.tv_sec * 1000000);
 
-	rc = select(++nfds, &poll_file_descriptors, NULL, NULL, &timeout);
+	rc = select(++nfds, &poll_file_descriptors, &poll_write_descriptors, NULL, &timeout);
 
 	assert(rc != EINVAL);
 
 	if (rc == -1) {
 		FD_ZERO(&poll_file_descriptors);
+		FD_ZERO(&poll_write_descriptors);
 	}
 
 	return (rc > 0);
 }
 
 /**
- * Return true if there is data on the MPD socket. Remember to call
- * poll_events() beforehand.
+ * Return true if the MPD IDLE socket has data, or room for the IDLE command.
+ * Remember to call poll_events() beforehand.
  */
 bool
 Pms::has_mpd_events()
 {
-	return FD_ISSET(conn->get_mpd_file_descriptor(), &poll_file_descriptors);
+	int fd;
+
+	fd = comm->get_idle_file_descriptor();
+
+	return (fd != -1 && (FD_ISSET(fd, &poll_file_descriptors) || FD_ISSET(fd, &poll_write_descriptors)));
 }
 
 /**
@@ -279,22 +309,79 @@ Pms::activate_startup_list()
 bool
 Pms::run_has_idle_events()
 {
-	enum mpd_idle idle_reply;
+	int fd;
 
-	if (!has_mpd_events()) {
+	if (!comm->is_idle() || !has_mpd_events()) {
 		return false;
 	}
 
-	pms->log(MSG_DEBUG, 0, "Received IDLE reply from server.\n");
-	idle_reply = mpd_recv_idle(conn->h(), true);
+	/* Finish sending the IDLE command, or read the reply, which may not
+	 * be complete yet */
+	fd = comm->get_idle_file_descriptor();
+	comm->run_idle(FD_ISSET(fd, &poll_file_descriptors), FD_ISSET(fd, &poll_write_descriptors));
+	if (comm->is_idle()) {
+		return false;
+	}
 
-	comm->set_mpd_idle_events(idle_reply);
-	comm->set_is_idle(false);
+	pms->log(MSG_DEBUG, 0, "Received IDLE reply from server.\n");
 	timer_elapsed = get_clock();
 
 	return true;
 }
 
+/**
+ * Return the number of seconds to wait before the next reconnection attempt.
+ * The delay doubles with each failed attempt, up to the 'reconnectdelay'
+ * option, and is picked at random from the upper half of that range so that
+ * many clients do not reconnect in lockstep after a server restart.
+ */
+long
+Pms::reconnect_delay()
+{
+	long delay;
+
+	delay = (reconnect_attempts < 16 ? 1L << reconnect_attempts : options->reconnectdelay);
+	if (delay > options->reconnectdelay) {
+		delay = options->reconnectdelay;
+	}
+	if (delay < 1) {
+		return 0;
+	}
+
+	++reconnect_attempts;
+
+	return delay / 2 + rand() % (delay - delay / 2 + 1);
+}
+
+/**
+ * Send queued commands and dispatch responses on the asynchronous command
+ * connection, as far as the socket allows without blocking.
+ *
+ * Returns true if the socket was ready, false if not.
+ */
+bool
+Pms::run_async_events()
+{
+	int	fd;
+	bool	readable;
+	bool	writable;
+
+	if ((fd = comm->get_async_file_descriptor()) == -1) {
+		return false;
+	}
+
+	readable = FD_ISSET(fd, &poll_file_descriptors);
+	writable = FD_ISSET(fd, &poll_write_descriptors);
+
+	if (!readable && !writable) {
+		return false;
+	}
+
+	comm->run_async(readable, writable);
+
+	return true;
+}
+
 /**
  * Check if currently playing song has changed since last call.
  *
@@ -303,14 +390,12 @@ Pms::run_has_idle_events()
 bool
 Pms::song_changed()
 {
-	Song * song;
 	static song_t last_song_id = MPD_SONG_NO_ID;
 	song_t current_song_id;
 	bool rc;
 
-	song = cursong();
-	if (song) {
-		current_song_id = song->id;
+	if (cursong()) {
+		current_song_id = cursong_id();
 	} else {
 		current_song_id = MPD_SONG_NO_ID;
 	}
@@ -339,7 +424,7 @@ Pms::goto_current_playing_song()
 
 	songlist = SONGLIST(disp->active_list);
 
-	while (!songlist || (list_item = songlist->find(cursong())) == NULL) {
+	while (!songlist || (list_item = songlist->find(cursong(), cursong_id())) == NULL) {
 		if (songlist == comm->queue()) {
 			return false;
 		} else if (list_item) {
@@ -349,7 +434,7 @@ Pms::goto_current_playing_song()
 		disp->activate_list(songlist);
 	}
 
-	songlist->set_cursor(list_item->song->pos);
+	songlist->set_cursor(list_item->pos);
 
 	return true;
 }
@@ -371,6 +456,7 @@ Pms::run_options_changed()
 	if (flags & OPT_GROUP_CONNECTION) {
 		log(MSG_DEBUG, 0, "Connection settings have been changed; disconnecting from MPD server.\n");
 		conn->disconnect();
+		comm->reset_async();
 	}
 
 	if (flags & OPT_GROUP_DISPLAY) {
@@ -440,8 +526,13 @@ Pms::run_stdin_events()
 bool
 Pms::run_all_events()
 {
-	/* Block until events received or timeout reached. */
-	poll_events(MAIN_LOOP_INTERVAL);
+	/* Block until events received or timeout reached. Don't wait while
+	 * the library is loading on the main connection, so the next chunk
+	 * is received right away. */
+	poll_events(comm->connection_busy() ? 0 : MAIN_LOOP_INTERVAL);
+
+	/* Responses to commands sent earlier need no further attention. */
+	run_async_events();
 
 	/* Process events from the IDLE socket. */
 	if (run_has_idle_events()) {
@@ -468,6 +559,7 @@ Pms::main()
 	bool			songchanged = false;
 	time_t			timer = 0;
 	int			rc;
+	ListItemSong *		list_item;
 	bool need_init_follow_playback = true;
 
 	/* Error codes returned from MPD */
@@ -593,8 +685,8 @@ Pms::main()
 			timer_tmp = difftime(timer_now, timer_reconnect);
 			if (timer_tmp.tv_sec < 0) {
 				timer_reconnect = get_clock();
-				timer_reconnect.tv_sec += options->reconnectdelay;
-				conn->connect();
+				timer_reconnect.tv_sec += reconnect_delay();
+				comm->reconnect();
 				continue;
 			}
 
@@ -610,8 +702,10 @@ Pms::main()
 
 		/* At this point, we have a working connection to MPD. Here,
 		 * the time to reconnect is temporarily set to 0 seconds.
-		 * Subsequent attempts will use the 'reconnectdelay' option. */
+		 * Subsequent attempts back off up to the 'reconnectdelay'
+		 * option. */
 		timer_reconnect = get_clock();
+		reconnect_attempts = 0;
 
 		/* Increase time elapsed. */
 		if (comm->status()->state == MPD_STATE_PLAY) {
@@ -633,10 +727,18 @@ Pms::main()
 		/* FIXME: move responsibilities? */
 		if (comm->has_finished_update(MPD_IDLE_DATABASE)) {
 			log(MSG_STATUS, STOK, _("Library has been updated."));
+			log(MSG_DEBUG, 0, "Tag pool holds %lu strings in %lu bytes, saving %lu bytes\n",
+					Tag::pool().size(), Tag::pool().stored_bytes(), Tag::pool().saved_bytes());
 			// FIXME
 			//disp->actwin()->wantdraw = true;
+			/* Keep the cursor on the same song through the sort */
+			list_item = LISTITEMSONG(comm->library()->cursor_item());
 			comm->library()->sort(options->sort);
+			if (list_item) {
+				comm->library()->set_cursor(list_item->pos);
+			}
 			comm->library()->set_column_size();
+			comm->save_library_cache();
 			comm->clear_finished_update(MPD_IDLE_DATABASE);
 		}
 
@@ -662,7 +764,7 @@ Pms::main()
 			/* Shell command when song finishes */
 			/* FIXME: move into separate function */
 			if (comm->status()->state == MPD_STATE_STOP && input->getpending() != PEND_STOP) {
-				if (options->onplaylistfinish.size() > 0 && cursong() && cursong()->pos == comm->queue()->size() - 1) {
+				if (options->onplaylistfinish.size() > 0 && cursong() && cursong_pos() == comm->queue()->size() - 1) {
 					log(MSG_CONSOLE, STOK, _("Reached end of playlist, running automation command: %s"), options->onplaylistfinish.c_str());
 					int code = system(options->onplaylistfinish.c_str());
 				}
@@ -706,11 +808,11 @@ Pms::main()
 		 * the main loop.
 		 */
 
-		/* Ensure that we are in IDLE mode. */
+		/* Ensure that we are waiting for IDLE events. If the IDLE
+		 * connection can not be opened, it is retried after the
+		 * next poll. */
 		if (!comm->is_idle()) {
-			if (!comm->idle()) {
-				continue;
-			}
+			comm->idle();
 		}
 
 		/* Process MPD and standard input events */
@@ -1180,6 +1282,24 @@ Song *			Pms::cursong()
 	return comm->song();
 }
 
+/*
+ * Returns the queue position of the currently playing song
+ */
+song_t			Pms::cursong_pos()
+{
+	assert(comm != NULL);
+	return comm->song_pos();
+}
+
+/*
+ * Returns the queue id of the currently playing song
+ */
+song_t			Pms::cursong_id()
+{
+	assert(comm != NULL);
+	return comm->song_id();
+}
+
 /*
  * Reset status to its natural state.
  */
@@ -1277,7 +1397,7 @@ Pms::playstring()
 	}
 
 	/* FIXME: separate function? */
-	is_last_in_playlist = (cursong()->pos == comm->queue()->size() - 1);
+	is_last_in_playlist = (cursong_pos() == comm->queue()->size() - 1);
 
 	if (status->repeat) {
 		s += "songs from queue repeatedly.";
@@ -1446,10 +1566,10 @@ bool			Pms::progress_nextsong()
 	}
 
 	/* Defeat desync with server */
-	last_song_id = cursong()->id;
+	last_song_id = cursong_id();
 
 	/* Normal progression: reached end of playlist */
-	if (cursong()->pos == static_cast<int>(comm->queue()->size() - 1)) {
+	if (cursong_pos() == static_cast<int>(comm->queue()->size() - 1)) {
 
 		pms->log(MSG_DEBUG, 0, "Auto-progressing to next song.\n");
 
@@ -100,6 +100,7 @@ private:
 
 	/* Polling */
 	fd_set				poll_file_descriptors;
+	fd_set				poll_write_descriptors;
 
 	/* Timers */
 	struct timespec			timer_now;
@@ -108,8 +109,10 @@ private:
 	struct timespec			timer_statusbar;
 	struct timespec			timer_tmp;
 
-	/* Internal timer */
-	struct timespec			get_clock();
+	/* Failed reconnection attempts since the connection was lost */
+	unsigned int			reconnect_attempts;
+
+	long				reconnect_delay();
 
 	/* Pending actions bitmask. A combination of the PENDING_ACTION_*
 	 * defined above. */
@@ -146,6 +149,9 @@ public:
 	Message *			msg;
 	Interface *			interface;
 
+	/* Monotonic clock, also used for timing measurements */
+	struct timespec			get_clock();
+
 	/* Global public functions */
 	static string			tostring(long);
 	static string			tostring(int);
@@ -202,6 +208,7 @@ public:
 
 	/* Public member functions */
 	bool				run_has_idle_events();
+	bool				run_async_events();
 	bool				run_options_changed();
 	bool				run_stdin_events();
 	bool				run_all_events();
@@ -214,6 +221,8 @@ public:
 	void				shutdown() { _shutdown = true; };
 	bool				run_shell(string);
 	Song *				cursong();
+	song_t				cursong_pos();
+	song_t				cursong_id();
 	string				playstring();
 	void				putlog(Message *);			// Put an arbitrary message into the message log.
 	void				log(int, long, const char *, ...);
@@ -38,11 +38,29 @@ Queue::remove(ListItem * i)
 	ListItemSong * item_song;
 	
 	item_song = LISTITEMSONG(i);
-	assert(item_song->song->id != MPD_SONG_NO_ID);
+	assert(item_song->id != MPD_SONG_NO_ID);
 
 	EXIT_IDLE;
 
-	pms->log(MSG_DEBUG, 0, "Removing song from queue: id=%d pos=%d uri=%s\n", item_song->song->id, item_song->song->pos, item_song->song->file.c_str());
+	pms->log(MSG_DEBUG, 0, "Removing song from queue: id=%d pos=%d uri=%s\n", item_song->id, item_song->pos, item_song->song->file.c_str());
 
-	return mpd_run_delete_id(pms->conn->h(), item_song->song->id);
+	return mpd_run_delete_id(pms->conn->h(), item_song->id);
+}
+
+/*
+ * Remove many songs in as few round trips as possible.
+ */
+bool
+Queue::remove_items(const vector<ListItem *> & items)
+{
+	vector<ListItemSong *>	songs;
+	vector<bool>		succeeded;
+	vector<ListItem *>::const_iterator iter;
+
+	songs.reserve(items.size());
+	for (iter = items.begin(); iter != items.end(); ++iter) {
+		songs.push_back(LISTITEMSONG(*iter));
+	}
+
+	return pms->comm->remove(this, songs, succeeded);
 }
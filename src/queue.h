@@ -36,6 +36,7 @@ public:
 	 * Returns true on success, false on failure.
 	 */
 	bool			remove(ListItem * i);
+	bool			remove_items(const vector<ListItem *> & items);
 };
 
 #endif /* _PMS_QUEUE_H_ */
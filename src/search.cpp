@@ -17,87 +17,80 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-
 #include "search.h"
-#include <string>
+#include <ctype.h>
+#include <stdlib.h>
 
 using namespace std;
 
-#ifdef HAVE_REGEX
-#include <regex>
-bool
-match_regex(string * source, string * pattern)
+Matcher::Matcher(const string & n_term, bool n_exact, bool n_regex)
 {
-	bool matched;
-	regex reg;
+	string::iterator	it;
 
-	try
-	{
-		reg.assign(*pattern, std::regex_constants::icase);
-		matched = regex_search(*source, reg);
-	}
-	catch (std::regex_error& err)
-	{
-		return false;
+	term = n_term;
+	exact = n_exact;
+	number_ = atol(n_term.c_str());
+
+	for (it = term.begin(); it != term.end(); ++it) {
+		*it = ::toupper((unsigned char) *it);
 	}
 
-	return matched;
-}
+#ifdef HAVE_REGEX
+	use_regex = (n_regex && !n_exact);
+	valid_regex = false;
+
+	if (use_regex) {
+		try
+		{
+			expression.assign(n_term, std::regex_constants::icase);
+			valid_regex = true;
+		}
+		catch (std::regex_error& err)
+		{
+		}
+	}
 #endif
-
-bool
-match_exact(string * s1, string * s2)
-{
-	return match_run(s1, s2, true);
 }
 
 bool
-match_inside(string * haystack, string * needle)
-{
-	return match_run(haystack, needle, false);
-}
-
-static bool
-match_run(string * haystack, string * needle, bool exact)
+Matcher::match(const char * source, size_t length) const
 {
-	bool			matched = exact;
+	size_t		i;
+	size_t		j;
 
-	string::const_iterator	it_haystack;
-	string::const_iterator	it_needle;
+#ifdef HAVE_REGEX
+	if (use_regex) {
+		return (valid_regex && regex_search(source, source + length, expression));
+	}
+#endif
 
-	for (it_haystack = haystack->begin(), it_needle = needle->begin(); it_haystack != haystack->end() && it_needle != needle->end(); it_haystack++)
-	{
-		/* exit if there aren't enough characters left to match the string */
-		if (haystack->end() - it_haystack < needle->end() - it_needle) {
+	if (exact) {
+		if (length != term.size()) {
 			return false;
 		}
-
-		/* check next character in needle with character in haystack */
-		if (::toupper(*it_needle) == ::toupper(*it_haystack)) {
-			/* matched a letter -- look for next letter */
-			matched = true;
-			it_needle++;
-		} else if (exact) {
-			/* didn't match a letter but need exact match */
-			return false;
-		} else {
-			/* didn't match a letter -- start from first letter of needle */
-			matched = false;
-			it_needle = needle->begin();
+		for (i = 0; i < length; i++) {
+			if ((char) ::toupper((unsigned char) source[i]) != term[i]) {
+				return false;
+			}
 		}
+		return true;
 	}
 
-	if (it_needle != needle->end()) {
-		/* end of the haystack before getting to the end of the needle */
+	/* An empty term is not found inside anything */
+	if (term.size() == 0 || length < term.size()) {
 		return false;
 	}
 
-	if (exact && it_needle == needle->end() && it_haystack != haystack->end()) {
-		/* need exact and got to the end of the needle but not the end of the
-		 * haystack */
-		return false;
+	for (i = 0; i + term.size() <= length; i++) {
+		for (j = 0; j < term.size(); j++) {
+			if ((char) ::toupper((unsigned char) source[i + j]) != term[j]) {
+				break;
+			}
+		}
+		if (j == term.size()) {
+			return true;
+		}
 	}
 
-	return matched;
+	return false;
 }
-
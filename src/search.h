@@ -23,41 +23,50 @@
 
 #include "../config.h"
 #include <string>
-
-using namespace std;
+#include <stddef.h>
 
 #ifdef HAVE_REGEX
-	/**
-	 * Match a string against a regular expression, case insensitively.
-	 *
-	 * Returns true if the regular expression matches, false otherwise.
-	 */
-	bool
-	match_regex(string * source, string * pattern);
+#include <regex>
 #endif
 
-/**
- * Match a string against another string, case insensitively.
- *
- * Returns true if the strings are identical, false otherwise.
- */
-bool
-match_exact(string * s1, string * s2);
+using namespace std;
 
 /**
- * Match a string inside another string, case insensitively.
- *
- * Returns true if needle is found inside haystack.
+ * A search term, prepared once and then matched against any number of
+ * strings. Matching is case insensitive, and does not allocate memory.
  */
-bool
-match_inside(string * haystack, string * needle);
+class Matcher
+{
+private:
+	/* The term, upper-cased */
+	string			term;
+	bool			exact;
+	long			number_;
 
-/**
- * Implementation of match_exact and match_inside.
- *
- * Returns true if needle is found inside haystack.
- */
-static bool
-match_run(string * haystack, string * needle, bool exact);
+#ifdef HAVE_REGEX
+	bool			use_regex;
+	bool			valid_regex;
+	regex			expression;
+#endif
+
+public:
+	/**
+	 * Prepare a term for matching. With 'exact', the whole string must
+	 * be equal to the term. Otherwise, the term must be found inside it,
+	 * or, with 'regex', the term is a regular expression to search for.
+	 */
+				Matcher(const string & term, bool exact, bool regex);
+
+	/**
+	 * Returns true if the string matches the term, false otherwise.
+	 */
+	bool			match(const char * source, size_t length) const;
+	bool			match(const string & source) const { return match(source.data(), source.size()); };
+
+	/**
+	 * The term as a number, for range comparisons.
+	 */
+	long			number() const { return number_; };
+};
 
 #endif /* _PMS_SEARCH_H_ */
@@ -0,0 +1,136 @@
+/* vi:set ts=8 sts=8 sw=8 noet:
+ *
+ * PMS	<<Practical Music Search>>
+ * Copyright (C) 2006-2015  Kim Tore Jensen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * slab.cpp
+ * 	fixed-size object allocator
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <new>
+
+#include "slab.h"
+
+Slab::Slab(size_t size, size_t objects_per_block)
+{
+	/* Every free object must be able to hold the free list pointer, and
+	 * stay aligned for any type. */
+	if (size < sizeof(void *)) {
+		size = sizeof(void *);
+	}
+	object_size = (size + sizeof(long double) - 1) & ~(sizeof(long double) - 1);
+	block_objects = objects_per_block;
+	free_list = NULL;
+	live_ = 0;
+	allocations_ = 0;
+}
+
+void
+Slab::grow()
+{
+	char *		block;
+	void *		ptr;
+	size_t		i;
+
+	/* Operator new must not return NULL */
+	block = static_cast<char *>(malloc(object_size * block_objects));
+	if (block == NULL) {
+		throw std::bad_alloc();
+	}
+
+	blocks.push_back(block);
+
+	/* Link objects in address order */
+	for (i = block_objects; i > 0; i--) {
+		ptr = block + (i - 1) * object_size;
+		*static_cast<void **>(ptr) = free_list;
+		free_list = ptr;
+	}
+}
+
+void *
+Slab::alloc()
+{
+	void *		ptr;
+
+	if (free_list == NULL) {
+		grow();
+	}
+
+	ptr = free_list;
+	free_list = *static_cast<void **>(ptr);
+
+	++live_;
+	++allocations_;
+
+	return ptr;
+}
+
+void
+Slab::free(void * ptr)
+{
+	if (ptr == NULL) {
+		return;
+	}
+
+	assert(live_ > 0);
+
+	*static_cast<void **>(ptr) = free_list;
+	free_list = ptr;
+
+	--live_;
+}
+
+long
+peak_rss()
+{
+	struct rusage	usage;
+
+	if (getrusage(RUSAGE_SELF, &usage) != 0) {
+		return 0;
+	}
+
+	/* Linux and the BSDs report kilobytes */
+	return usage.ru_maxrss;
+}
+
+long
+current_rss()
+{
+	FILE *		fp;
+	long		size;
+	long		resident;
+
+	/* Only available on systems with a Linux style procfs */
+	if ((fp = fopen("/proc/self/statm", "r")) == NULL) {
+		return 0;
+	}
+
+	if (fscanf(fp, "%ld %ld", &size, &resident) != 2) {
+		resident = 0;
+	}
+
+	fclose(fp);
+
+	return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
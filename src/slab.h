@@ -0,0 +1,100 @@
+/* vi:set ts=8 sts=8 sw=8 noet:
+ *
+ * PMS	<<Practical Music Search>>
+ * Copyright (C) 2006-2015  Kim Tore Jensen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * slab.h
+ * 	fixed-size object allocator
+ */
+
+#ifndef _PMS_SLAB_H_
+#define _PMS_SLAB_H_
+
+#include <vector>
+#include <stddef.h>
+
+using namespace std;
+
+
+/**
+ * Allocator for many objects of the same size. Memory is taken from the
+ * system in large blocks and handed out one object at a time. Freed objects
+ * are put on a free list and reused by the next allocation, so rebuilding a
+ * large list does not churn the heap. Blocks are never returned to the
+ * system.
+ */
+class Slab
+{
+private:
+	size_t			object_size;
+	size_t			block_objects;
+	vector<char *>		blocks;
+	void *			free_list;
+
+	unsigned long		live_;
+	unsigned long		allocations_;
+
+	/* Carve a new block into free objects */
+	void			grow();
+
+public:
+				Slab(size_t size, size_t objects_per_block = 4096);
+
+	/**
+	 * Return memory for one object.
+	 */
+	void *			alloc();
+
+	/**
+	 * Put an object back on the free list.
+	 */
+	void			free(void * ptr);
+
+	/**
+	 * Number of objects currently in use.
+	 */
+	unsigned long		live() const { return live_; };
+
+	/**
+	 * Number of objects handed out since startup.
+	 */
+	unsigned long		allocations() const { return allocations_; };
+
+	/**
+	 * Number of blocks requested from the system.
+	 */
+	unsigned long		block_count() const { return blocks.size(); };
+
+	/**
+	 * Total bytes held by this allocator.
+	 */
+	unsigned long		bytes() const { return blocks.size() * block_objects * object_size; };
+};
+
+/**
+ * Return the peak resident set size of this process in kilobytes, or zero if
+ * it is not available.
+ */
+long			peak_rss();
+
+/**
+ * Return the current resident set size of this process in kilobytes, or zero
+ * if it is not available.
+ */
+long			current_rss();
+
+#endif /* _PMS_SLAB_H_ */
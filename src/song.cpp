@@ -28,15 +28,130 @@
 #include "pms.h"
 #include <string>
 #include <vector>
+#include <unordered_map>
 
 extern Pms * pms;
 
-Song::Song(const mpd_song * song)
+typedef unordered_map<Tag, Song *, TagHash>	songmap;
+
+/*
+ * All song objects currently in memory, indexed by URI.
+ */
+static songmap &
+songs()
+{
+	static songmap	m;
+	return m;
+}
+
+static unsigned long	song_revision = 0;
+
+Song *
+Song::acquire(const mpd_song * song)
 {
-	selected	= false;
+	songmap::iterator	iter;
+	Song *			s;
+	Tag			uri;
 
 	assert(mpd_song_get_uri(song) != NULL);
 
+	uri = mpd_song_get_uri(song);
+	iter = songs().find(uri);
+
+	if (iter == songs().end()) {
+		s = new Song(uri);
+		s->assign(song);
+		return s;
+	}
+
+	s = iter->second->retain();
+
+	/* Streams and songs without a modification time may change tags at
+	 * any time, so those are always re-read. */
+	if (!s->last_modified || s->last_modified != mpd_song_get_last_modified(song)) {
+		s->assign(song);
+		++song_revision;
+	}
+
+	return s;
+}
+
+Song *
+Song::acquire(const string & uri)
+{
+	songmap::iterator	iter;
+
+	iter = songs().find(Tag(uri));
+	if (iter != songs().end()) {
+		return iter->second->retain();
+	}
+
+	return new Song(uri);
+}
+
+Song *
+Song::find(const string & uri)
+{
+	songmap::iterator	iter;
+
+	iter = songs().find(Tag(uri));
+
+	return (iter == songs().end() ? NULL : iter->second);
+}
+
+void *
+Song::operator new(size_t size)
+{
+	assert(size == sizeof(Song));
+	return slab().alloc();
+}
+
+void
+Song::operator delete(void * ptr)
+{
+	slab().free(ptr);
+}
+
+Slab &
+Song::slab()
+{
+	/* Never destroyed, songs may outlive static destructors */
+	static Slab *	s = new Slab(sizeof(Song));
+	return *s;
+}
+
+Song *
+Song::retain()
+{
+	++refs;
+	return this;
+}
+
+void
+Song::release()
+{
+	assert(refs > 0);
+
+	if (--refs == 0) {
+		delete this;
+	}
+}
+
+unsigned long
+Song::count()
+{
+	return songs().size();
+}
+
+unsigned long
+Song::revision()
+{
+	return song_revision;
+}
+
+void
+Song::assign(const mpd_song * song)
+{
 	file			= Pms::tostring(mpd_song_get_uri(song));
 	artist			= Pms::tostring(mpd_song_get_tag(song, MPD_TAG_ARTIST, 0));
 	albumartist		= Pms::tostring(mpd_song_get_tag(song, MPD_TAG_ALBUM_ARTIST, 0));
@@ -72,44 +187,16 @@ Song::Song(const mpd_song * song)
 	comment			= Pms::tostring(mpd_song_get_tag(song, MPD_TAG_COMMENT, 0));
 
 	time			= mpd_song_get_duration(song);
-	pos			= mpd_song_get_pos(song);
-	id			= mpd_song_get_id(song);
-
-	init();
-}
-
-Song::Song(const Song * song)
-{
-	selected		= false;
-
-	file			= song->file;
-	artist			= song->artist;
-	albumartist		= song->albumartist;
-	artistsort		= song->artistsort;
-	albumartistsort		= song->albumartistsort;
-	title			= song->title;
-	album			= song->album;
-	track			= song->track;
-	trackshort		= song->trackshort;
-	name			= song->name;
-	date			= song->date;
-
-	genre			= song->genre;
-	composer		= song->composer;
-	performer		= song->performer;
-	disc			= song->disc;
-	comment			= song->comment;
-
-	time			= song->time;
-	pos			= song->pos;
-	id			= song->id;
+	last_modified		= mpd_song_get_last_modified(song);
 
 	init();
 }
 
 Song::Song(const string uri)
 {
+	refs			= 1;
 	selected		= false;
+	tagged			= false;
 
 	file			= uri;
 	artist			= "";
@@ -131,12 +218,18 @@ Song::Song(const string uri)
 	comment			= "";
 
 	time			= MPD_SONG_NO_TIME;
-	pos			= MPD_SONG_NO_NUM;
-	id			= MPD_SONG_NO_ID;
+	last_modified		= 0;
+
+	tracknum		= 0;
+	discnum			= 0;
+	yearnum			= 0;
+
+	songs()[file] = this;
 }
 
 Song::~Song()
 {
+	songs().erase(file);
 }
 
 /*
@@ -146,10 +239,13 @@ void		Song::init()
 {
 	const string			the = "the";
 	string				tmp;
-	vector<string *>		original;
-	vector<string *>		rewritten;
-	vector<string *>::iterator	src;
-	vector<string *>::iterator	dest;
+	vector<Tag *>			original;
+	vector<Tag *>			rewritten;
+	vector<Tag *>::iterator		src;
+	vector<Tag *>::iterator		dest;
+
+	/* Only called once the tags have been imported */
+	tagged = true;
 
 	/* year from date */
 	if (date.size() >= 4) {
@@ -160,7 +256,13 @@ void		Song::init()
 
 	/* strip zeros and total tracks from the 'track' tag,
 	 * and store it in 'trackshort'. */
-	trackshort = strip_leading_zeroes(&track);
+	trackshort = strip_leading_zeroes(track);
+
+	/* Numeric values for sorting and range matching. atoi() stops at
+	 * the slash in 'track/total' and at the dash in 'yyyy-mm-dd'. */
+	tracknum = atoi(track.c_str());
+	discnum = atoi(disc.c_str());
+	yearnum = atoi(year.c_str());
 
 	/* Generate rudimentary sort names if none available, by
 	 * rewriting 'The Artist' to 'Artist, The'. */
@@ -200,14 +302,14 @@ next:
 }
 
 string
-Song::strip_leading_zeroes(string * src)
+Song::strip_leading_zeroes(const string & src)
 {
 	bool zero = true;
 	string s;
 	string::const_iterator iter;
 
-	iter = src->begin();
-	while (iter != src->end() && *iter != '/') {
+	iter = src.begin();
+	while (iter != src.end() && *iter != '/') {
 		if (!zero || *iter != '0') {
 			zero = false;
 			s += *iter;
@@ -229,67 +331,133 @@ string		Song::dirname()
 	if (file.size() == 0)
 		return ret;
 
-	p = file.find_last_of("/\\");
+	p = file.str().find_last_of("/\\");
 	if (p == string::npos)
 		return ret;
 
 	return file.substr(0, p);
 }
 
+/*
+ * Tag fields in the order they are tried when matching. ID and position come
+ * last, since a search for them is unlikely to include any other field.
+ */
+static const struct
+{
+	long		field;
+	Tag Song::*	member;
+}
+match_fields[] = {
+	{ MATCH_TITLE,			&Song::title },
+	{ MATCH_ARTIST,			&Song::artist },
+	{ MATCH_ALBUMARTIST,		&Song::albumartist },
+	{ MATCH_COMPOSER,		&Song::composer },
+	{ MATCH_PERFORMER,		&Song::performer },
+	{ MATCH_ALBUM,			&Song::album },
+	{ MATCH_GENRE,			&Song::genre },
+	{ MATCH_DATE,			&Song::date },
+	{ MATCH_COMMENT,		&Song::comment },
+	{ MATCH_TRACKSHORT,		&Song::trackshort },
+	{ MATCH_DISC,			&Song::disc },
+	{ MATCH_FILE,			&Song::file },
+	{ MATCH_ARTISTSORT,		&Song::artistsort },
+	{ MATCH_ALBUMARTISTSORT,	&Song::albumartistsort },
+	{ MATCH_YEAR,			&Song::year },
+};
+
 bool
-Song::match(string term, long flags)
+Song::match(const string & term, long flags, song_t id, song_t pos)
 {
-	vector<string>	sources;
-	bool		matched;
-	unsigned int	j;
-
-	/* try the sources in order of likeliness. ID etc last since if we're
-	 * searching for them we likely won't be searching any of the other
-	 * fields. */
-	if (flags & MATCH_TITLE)		sources.push_back(title);
-	if (flags & MATCH_ARTIST)		sources.push_back(artist);
-	if (flags & MATCH_ALBUMARTIST)		sources.push_back(albumartist);
-	if (flags & MATCH_COMPOSER)		sources.push_back(composer);
-	if (flags & MATCH_PERFORMER)		sources.push_back(performer);
-	if (flags & MATCH_ALBUM)		sources.push_back(album);
-	if (flags & MATCH_GENRE)		sources.push_back(genre);
-	if (flags & MATCH_DATE)			sources.push_back(date);
-	if (flags & MATCH_COMMENT)		sources.push_back(comment);
-	if (flags & MATCH_TRACKSHORT)		sources.push_back(trackshort);
-	if (flags & MATCH_DISC)			sources.push_back(disc);
-	if (flags & MATCH_FILE)			sources.push_back(file);
-	if (flags & MATCH_ARTISTSORT)		sources.push_back(artistsort);
-	if (flags & MATCH_ALBUMARTISTSORT)	sources.push_back(albumartistsort);
-	if (flags & MATCH_YEAR)			sources.push_back(year);
-	if (flags & MATCH_ID)			sources.push_back(Pms::tostring(id));
-	if (flags & MATCH_POS)			sources.push_back(Pms::tostring(pos));
-
-	for (j = 0; j < sources.size(); j++)
-	{
-		if (flags & MATCH_EXACT) {
-			matched = match_exact(&(sources[j]), &term);
-		}
-#ifdef HAVE_REGEX
-		else if (pms->options->regexsearch) {
-			matched = match_regex(&(sources[j]), &term);
-		}
-#endif
-		else {
-			matched = match_inside(&(sources[j]), &term);
+	return match(matcher(term, flags), flags, id, pos);
+}
+
+bool
+Song::match(const Matcher & matcher, long flags, song_t id, song_t pos)
+{
+	bool		invert = !!(flags & MATCH_NOT);
+	char		number[24];
+	int		length;
+	unsigned int	i;
+
+	if (flags & (MATCH_LT | MATCH_LTE | MATCH_GT | MATCH_GTE)) {
+		return (match_range(matcher.number(), flags, id, pos) != invert);
+	}
+
+	/* A song matches if any field matches, or with MATCH_NOT, if any
+	 * field does not match. */
+	for (i = 0; i < sizeof(match_fields) / sizeof(match_fields[0]); i++) {
+		if ((flags & match_fields[i].field) && matcher.match((this->*match_fields[i].member).str()) != invert) {
+			return true;
 		}
+	}
 
-		if (matched) {
-			if (!(flags & MATCH_NOT)) {
-				return true;
-			} else {
-				continue;
-			}
+	if (flags & MATCH_ID) {
+		length = snprintf(number, sizeof(number), "%ld", id);
+		if (matcher.match(number, length) != invert) {
+			return true;
 		}
+	}
 
-		if (flags & MATCH_NOT) {
+	if (flags & MATCH_POS) {
+		length = snprintf(number, sizeof(number), "%ld", pos);
+		if (matcher.match(number, length) != invert) {
 			return true;
 		}
 	}
 
 	return false;
 }
+
+Matcher
+Song::matcher(const string & term, long flags)
+{
+	return Matcher(term, flags & MATCH_EXACT, pms->options->regexsearch);
+}
+
+bool
+Song::match_range(long value, long flags, song_t id, song_t pos)
+{
+	if ((flags & MATCH_TRACKSHORT)	&& compare(tracknum, value, flags))	return true;
+	if ((flags & MATCH_DISC)	&& compare(discnum, value, flags))	return true;
+	if ((flags & MATCH_YEAR)	&& compare(yearnum, value, flags))	return true;
+	if ((flags & MATCH_TIME)	&& compare(time, value, flags))		return true;
+	if ((flags & MATCH_ID)		&& compare(id, value, flags))		return true;
+	if ((flags & MATCH_POS)		&& compare(pos, value, flags))		return true;
+
+	return false;
+}
+
+bool
+Song::compare(long source, long value, long flags)
+{
+	if ((flags & MATCH_LT) && source < value)	return true;
+	if ((flags & MATCH_LTE) && source <= value)	return true;
+	if ((flags & MATCH_GT) && source > value)	return true;
+	if ((flags & MATCH_GTE) && source >= value)	return true;
+
+	return false;
+}
+
+Tag Song::*
+Song::tag_member(long field)
+{
+	switch(field)
+	{
+		case MATCH_FILE:		return &Song::file;
+		case MATCH_ARTIST:		return &Song::artist;
+		case MATCH_ARTISTSORT:		return &Song::artistsort;
+		case MATCH_ALBUMARTIST:		return &Song::albumartist;
+		case MATCH_ALBUMARTISTSORT:	return &Song::albumartistsort;
+		case MATCH_TITLE:		return &Song::title;
+		case MATCH_ALBUM:		return &Song::album;
+		case MATCH_TRACKSHORT:		return &Song::trackshort;
+		case MATCH_DATE:		return &Song::date;
+		case MATCH_GENRE:		return &Song::genre;
+		case MATCH_COMPOSER:		return &Song::composer;
+		case MATCH_PERFORMER:		return &Song::performer;
+		case MATCH_DISC:		return &Song::disc;
+		case MATCH_COMMENT:		return &Song::comment;
+		case MATCH_YEAR:		return &Song::year;
+		default:			return NULL;
+	}
+}
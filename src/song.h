@@ -25,8 +25,13 @@
 #define _SONG_H_
 
 #include <string>
+#include <time.h>
 #include <mpd/client.h>
 
+#include "tag.h"
+#include "slab.h"
+#include "search.h"
+
 typedef signed long song_t;
 
 #define MPD_SONG_NO_TIME -1
@@ -37,56 +42,163 @@ using namespace std;
 
 /*
  * Remember to update this as libmpd changes.
+ *
+ * There is only one Song object per URI. Lists refer to songs through
+ * ListItemSong, which holds a reference and the list-specific attributes
+ * such as position and queue id.
  */
 class Song
 {
-public:
-			Song(const mpd_song *);
-			Song(const Song *);
+private:
+	unsigned int	refs;
+
 			Song(const string);
 			~Song();
-	
+
+	/* Import all tags from a libmpdclient song object */
+	void		assign(const mpd_song *);
+
+public:
+	/**
+	 * Songs are allocated from a shared slab, so that rebuilding the
+	 * library reuses memory instead of going through the heap.
+	 */
+	static void *	operator new(size_t size);
+	static void	operator delete(void * ptr);
+	static Slab &	slab();
+
+	/**
+	 * Return the shared song object for the URI of an MPD song, creating
+	 * it if it does not exist yet. Tags are re-read only when the file
+	 * has been modified since they were last imported.
+	 *
+	 * The caller owns one reference to the returned song.
+	 */
+	static Song *	acquire(const mpd_song *);
+
+	/**
+	 * Return the shared song object for a URI, creating an empty one if
+	 * the URI is not known.
+	 *
+	 * The caller owns one reference to the returned song.
+	 */
+	static Song *	acquire(const string & uri);
+
+	/**
+	 * Return the shared song object for a URI, or NULL if the URI is not
+	 * known. No reference is added.
+	 */
+	static Song *	find(const string & uri);
+
+	/**
+	 * Add a reference to this song. Returns the song itself.
+	 */
+	Song *		retain();
+
+	/**
+	 * Drop a reference to this song, deleting it when unreferenced.
+	 */
+	void		release();
+
+	/**
+	 * Number of distinct song objects in memory.
+	 */
+	static unsigned long	count();
+
+	/**
+	 * Counter which is increased every time an existing song has its
+	 * tags re-read. Anything caching tag values can compare this to see
+	 * if the cache is stale.
+	 */
+	static unsigned long	revision();
+
 	/* Common function to initialize special fields that MPD don't return */
 
 	void		init();
-	string		strip_leading_zeroes(string * src);
+	string		strip_leading_zeroes(const string & src);
 	string		dirname();
 
 	/**
-	 * Match this song against a search string and criteria flags.
+	 * Match this song against a search string and criteria flags. The
+	 * list position and queue id of the song must be given by the caller
+	 * when matching against MATCH_POS or MATCH_ID.
+	 *
+	 * Returns true if song matches, false otherwise.
+	 */
+	bool		match(const string & term, long flags, song_t id = MPD_SONG_NO_ID, song_t pos = MPD_SONG_NO_NUM);
+
+	/**
+	 * Match this song against a term prepared with matcher(). Fields are
+	 * compared in place, so this does not allocate memory.
 	 *
 	 * Returns true if song matches, false otherwise.
 	 */
-	bool		match(string term, long flags);
+	bool		match(const Matcher & matcher, long flags, song_t id = MPD_SONG_NO_ID, song_t pos = MPD_SONG_NO_NUM);
+
+	/**
+	 * Prepare a search term for matching many songs or strings, using
+	 * the matching mode given in flags. MATCH_NOT is not taken into
+	 * account by the returned matcher.
+	 */
+	static Matcher	matcher(const string & term, long flags);
+
+	/**
+	 * Compare the numeric fields given in flags against a number, using
+	 * the MATCH_LT, MATCH_LTE, MATCH_GT or MATCH_GTE operator.
+	 *
+	 * Returns true if any of the fields satisfies the comparison.
+	 */
+	bool		match_range(long value, long flags, song_t id, song_t pos);
+
+	/**
+	 * Compare a number against a value, using the operator in flags.
+	 */
+	static bool	compare(long source, long value, long flags);
+
+	/**
+	 * Return a pointer to the tag member corresponding to a single
+	 * MATCH_* field flag, or NULL if the field is not a tag.
+	 */
+	static Tag Song::* tag_member(long field);
 
 	/* Custom parameters only used by PMS */
 	
 	bool		selected;
-	string		trackshort;
-
-	/* Standard parameters imported from libmpdclient.h */
-
-	string		file;
-	string		artist;
-	string		albumartist;
-	string		albumartistsort;
-	string		artistsort;
-	string		title;
-	string		album;
-	string		track;
-	string		name;
-	string		date;
-	string		year;
-
-	string		genre;
-	string		composer;
-	string		performer;
-	string		disc;
-	string		comment;
+	Tag		trackshort;
+
+	/* False for a song created from a bare URI, until its tags have been
+	 * imported from MPD or from the library cache. */
+	bool		tagged;
+
+	/* Standard parameters imported from libmpdclient.h. Tag values are
+	 * interned, so identical strings are shared between all songs. */
+
+	Tag		file;
+	Tag		artist;
+	Tag		albumartist;
+	Tag		albumartistsort;
+	Tag		artistsort;
+	Tag		title;
+	Tag		album;
+	Tag		track;
+	Tag		name;
+	Tag		date;
+	Tag		year;
+
+	Tag		genre;
+	Tag		composer;
+	Tag		performer;
+	Tag		disc;
+	Tag		comment;
 
 	int		time;
-	song_t		pos;
-	song_t		id;
+	time_t		last_modified;
+
+	/* Numeric values of the track, disc and year tags, parsed once when
+	 * the tags are imported. Zero if the tag is missing or not a number. */
+	int		tracknum;
+	int		discnum;
+	int		yearnum;
 };
 
 #endif /* _SONG_H_ */
@@ -25,6 +25,7 @@
 #ifdef HAVE_REGEX
 	#include <regex>
 #endif
+#include <algorithm>
 #include "conn.h"
 #include "songlist.h"
 #include "song.h"
@@ -35,7 +36,7 @@
 extern Pms *			pms;
 
 
-ListItemSong::ListItemSong(List * l, Song * s) :
+ListItemSong::ListItemSong(List * l, Song * s, song_t song_id) :
 ListItem(l)
 {
 	assert(l);
@@ -43,17 +44,39 @@ ListItem(l)
 
 	list = l;
 	song = s;
+	pos = MPD_SONG_NO_NUM;
+	id = song_id;
 }
 
 ListItemSong::~ListItemSong()
 {
-	delete song;
+	song->release();
+}
+
+void *
+ListItemSong::operator new(size_t size)
+{
+	assert(size == sizeof(ListItemSong));
+	return slab().alloc();
+}
+
+void
+ListItemSong::operator delete(void * ptr)
+{
+	slab().free(ptr);
+}
+
+Slab &
+ListItemSong::slab()
+{
+	static Slab *	s = new Slab(sizeof(ListItemSong));
+	return *s;
 }
 
 bool
 ListItemSong::match(string term, long flags)
 {
-	return song->match(term, flags);
+	return song->match(term, flags, id, pos);
 }
 
 /*
@@ -70,6 +93,8 @@ Songlist::Songlist()
 	filename = "";
 	selection_params.size = 0;
 	selection_params.length = 0;
+	columns_valid_ = false;
+	columns_revision_ = 0;
 }
 
 Songlist::~Songlist()
@@ -85,7 +110,19 @@ Songlist::song(uint32_t position)
 	assert(position >= 0);
 	assert(position < size());
 
-	return LISTITEMSONG(items[position])->song;
+	return typed(items[position])->song;
+}
+
+/*
+ * Return a pointer to the Nth list item.
+ */
+ListItemSong *
+Songlist::song_item(uint32_t position)
+{
+	assert(position >= 0);
+	assert(position < size());
+
+	return typed(items[position]);
 }
 
 /*
@@ -93,10 +130,10 @@ Songlist::song(uint32_t position)
  *
  * FIXME: should probably not be a part of the Songlist class
  */
-Song *
-Songlist::next_song_in_direction(Song * s, uint8_t direction, song_t * id)
+ListItemSong *
+Songlist::next_song_in_direction(Song * s, song_t s_pos, uint8_t direction, song_t * id)
 {
-	ListItem *	it;
+	ListItemSong *	it = NULL;
 	song_t		i = MATCH_FAILED;
 
 	assert(direction == 1 || direction == -1);
@@ -106,25 +143,25 @@ Songlist::next_song_in_direction(Song * s, uint8_t direction, song_t * id)
 		if (!size()) {
 			return NULL;
 		}
-		return song(0);
+		return song_item(0);
 	}
 
 	/* Find the current song in this list */
-	if (s->pos != MPD_SONG_NO_NUM && QUEUE(this)) {
-		it = match(Pms::tostring(s->pos), 0, size() - 1, MATCH_POS);
+	if (s_pos != MPD_SONG_NO_NUM && s_pos < size() && song(s_pos) == s) {
+		it = song_item(s_pos);
 	}
 
-	/* Fallback to file path */
+	/* Fallback to any occurrence of the song */
 	if (!it) {
-		it = match(s->file, 0, size() - 1, MATCH_EXACT | MATCH_FILE);
-		if (!it && !size()) {
+		it = find(s);
+		if (!it) {
 			return NULL;
 		}
 	}
 
 	/* Wrap around */
 	/* FIXME: not our responsibility */
-	i = LISTITEMSONG(it)->song->pos + direction;
+	i = it->pos + direction;
 	if (i < 0 || i >= size()) {
 		if (!pms->comm->status()->repeat) {
 			return NULL;
@@ -140,27 +177,27 @@ Songlist::next_song_in_direction(Song * s, uint8_t direction, song_t * id)
 		*id = i;
 	}
 
-	return song(i);
+	return song_item(i);
 }
 
-Song *
+ListItemSong *
 Songlist::nextsong(song_t * id)
 {
-	return next_song_in_direction(pms->cursong(), 1, id);
+	return next_song_in_direction(pms->cursong(), pms->cursong_pos(), 1, id);
 }
 
-Song *
+ListItemSong *
 Songlist::prevsong(song_t * id)
 {
-	return next_song_in_direction(pms->cursong(), -1, id);
+	return next_song_in_direction(pms->cursong(), pms->cursong_pos(), -1, id);
 }
 
 /*
  * Return a random song
  */
-Song *			Songlist::randsong(song_t * id)
+ListItemSong *		Songlist::randsong(song_t * id)
 {
-	Song *		s;
+	ListItemSong *	s;
 	song_t		i = 0;
 	unsigned long	processed = 0;
 
@@ -175,9 +212,9 @@ Song *			Songlist::randsong(song_t * id)
 
 	i %= size();
 
-	s = song(i);
-	if (s == pms->cursong()) {
-		return next_song_in_direction(s, -1, id);
+	s = song_item(i);
+	if (s->song == pms->cursong()) {
+		return next_song_in_direction(s->song, i, -1, id);
 	}
 
 	if (id != NULL) {
@@ -257,7 +294,7 @@ song_t		Songlist::findentry(Item field, bool reverse)
 		return MPD_SONG_NO_NUM;
 	}
 
-	s = LISTITEMSONG(it)->song;
+	s = typed(it)->song;
 
 	/* Reverse match must match first entry, not last */
 	if (reverse)
@@ -278,7 +315,6 @@ song_t		Songlist::findentry(Item field, bool reverse)
 void		Songlist::set(Songlist * list)
 {
 	unsigned int	i;
-	Song *		s;
 
 	if (list == NULL)	return;
 
@@ -286,10 +322,7 @@ void		Songlist::set(Songlist * list)
 
 	for (i = 0; i < list->size(); i++)
 	{
-		s = new Song(list->song(i));
-		s->id = MPD_SONG_NO_ID;
-		s->pos = MPD_SONG_NO_NUM;
-		add_local(s);
+		add_local(list->song(i)->retain());
 	}
 }
 
@@ -298,18 +331,19 @@ void		Songlist::set(Songlist * list)
  */
 void		Songlist::truncate_local(unsigned int maxsize)
 {
-	unsigned int	i;
+	vector<uint32_t>	positions;
+	unsigned int		i;
 
-	if (maxsize == 0)
-	{
-		this->clear();
+	if (maxsize >= size()) {
 		return;
 	}
 
-	for (i = size() - 1; i >= maxsize; i--)
-	{
-		remove_local(static_cast<int>(i));
+	positions.reserve(size() - maxsize);
+	for (i = maxsize; i < size(); i++) {
+		positions.push_back(i);
 	}
+
+	remove_local(positions);
 }
 
 song_t		Songlist::add_local(Songlist * list)
@@ -322,7 +356,7 @@ song_t		Songlist::add_local(Songlist * list)
 
 	for (i = 0; i < list->size(); i++)
 	{
-		result = add_local(new Song(list->song(i)));
+		result = add_local(list->song(i)->retain());
 		if (first == MPD_SONG_NO_ID && result != MPD_SONG_NO_ID)
 			first = result;
 	}
@@ -331,36 +365,40 @@ song_t		Songlist::add_local(Songlist * list)
 }
 
 song_t
-Songlist::add_local(Song * s)
+Songlist::add_local(Song * s, song_t pos, song_t id)
 {
-	Song * existing_song;
+	ListItemSong * list_item;
+	ListItemSong * existing_item;
 
 	assert(s != NULL);
-	assert(s->pos <= size());
+	assert(pos <= size());
+
+	//pms->log(MSG_DEBUG, 0, "Add to queue: id=%d pos=%d uri=%s\n", id, pos, s->file.c_str());
 
-	//pms->log(MSG_DEBUG, 0, "Add to queue: id=%d pos=%d uri=%s\n", s->id, s->pos, s->file.c_str());
+	list_item = new ListItemSong(this, s, id);
 
 	/* Append song to end of list */
-	if (s->pos == MPD_SONG_NO_NUM || s->pos == size()) {
-		items.push_back(new ListItemSong(this, s));
-		s->pos = size() - 1;
+	if (pos == MPD_SONG_NO_NUM || pos == size()) {
+		items.push_back(list_item);
+		list_item->pos = size() - 1;
 
 	/* Insert song into arbitrary position */
 	} else {
-		existing_song = song(s->pos);
-		assert(existing_song);
-		assert(existing_song->pos == s->pos);
-
-		subtract_song_length(existing_song->time);
-		delete item(s->pos);
-		items[s->pos] = new ListItemSong(this, s);
+		existing_item = song_item(pos);
+		assert(existing_item);
+		assert(existing_item->pos == pos);
+
+		subtract_song_length(existing_item->song->time);
+		delete existing_item;
+		items[pos] = list_item;
+		list_item->pos = pos;
 	}
 
 	add_song_length(s->time);
 
-	set_selection_cache_valid(false);
+	items_changed();
 
-	return s->pos;
+	return list_item->pos;
 }
 
 void
@@ -380,69 +418,322 @@ Songlist::subtract_song_length(int32_t t)
 }
 
 ListItemSong *
-Songlist::find(Song * s)
+Songlist::find(Song * s, song_t id)
 {
-	ListItem * it = NULL;
+	vector<ListItem *>::iterator iter;
+	ListItemSong * list_item;
 
 	assert(s);
 
-	if (s->id != MPD_SONG_NO_NUM && QUEUE(this)) {
-		it = match(Pms::tostring(pms->cursong()->id), 0, size() - 1, MATCH_ID | MATCH_EXACT);
-	} else if (s->pos != MPD_SONG_NO_NUM && QUEUE(this)) {
-		it = match(Pms::tostring(pms->cursong()->pos), 0, size() - 1, MATCH_POS | MATCH_EXACT);
+	if (id != MPD_SONG_NO_ID && QUEUE(this)) {
+		for (iter = items.begin(); iter != items.end(); ++iter) {
+			list_item = typed(*iter);
+			if (list_item->id == id) {
+				return list_item;
+			}
+		}
 	}
 
-	if (!it) {
-		it = match(s->file, 0, size() - 1, MATCH_FILE | MATCH_EXACT);
+	/* Songs are shared between lists, so comparing pointers is enough */
+	for (iter = items.begin(); iter != items.end(); ++iter) {
+		list_item = typed(*iter);
+		if (list_item->song == s) {
+			return list_item;
+		}
 	}
 
-	return LISTITEMSONG(it);
+	return NULL;
 }
 
 void
 Songlist::remove_local(uint32_t position)
 {
-	vector<ListItem *>::iterator iter;
-	ListItemSong * list_item;
-	Song * s;
-	song_t song_length;
+	remove_local(vector<uint32_t>(1, position));
+}
 
-	s = song(position);
-	assert(s);
+void
+Songlist::remove_local(const vector<uint32_t> & positions)
+{
+	vector<uint32_t>::const_iterator	pos;
+	uint32_t				i;
 
-	song_length = s->time;
+	if (positions.empty()) {
+		return;
+	}
 
-	List::remove_local(position);
+	for (pos = positions.begin(); pos != positions.end(); ++pos) {
+		subtract_song_length(song(*pos)->time);
+	}
 
-	subtract_song_length(song_length);
+	List::remove_local(positions);
 
-	iter = items.begin() + position;
+	/* Renumber the songs which moved down */
+	for (i = positions.front(); i < size(); i++) {
+		typed(items[i])->pos = i;
+	}
+}
 
-	/* Decrease song position of all following song instances */
-	while (iter != items.end()) {
-		list_item = LISTITEMSONG(*iter);
-		assert(list_item);
-		assert(list_item->song);
-		--list_item->song->pos;
-		++iter;
+void
+Songlist::move_local(const vector<uint32_t> & positions, int32_t offset)
+{
+	uint32_t	first;
+	uint32_t	last;
+	uint32_t	i;
+
+	if (positions.empty() || offset == 0) {
+		return;
+	}
+
+	List::move_local(positions, offset);
+
+	/* Renumber the songs in the rearranged span */
+	first = (offset < 0 ? positions.front() + offset : positions.front());
+	last = (offset < 0 ? positions.back() : positions.back() + offset);
+	for (i = first; i <= last; i++) {
+		typed(items[i])->pos = i;
 	}
 }
 
+void
+Songlist::replace_local(uint32_t position, uint32_t count, const vector<Song *> & songs)
+{
+	vector<ListItem *>	inserted;
+	vector<uint32_t>	positions;
+	uint32_t		common;
+	uint32_t		i;
+
+	assert(position + count <= size());
+
+	common = (count < songs.size() ? count : songs.size());
+
+	/* Where both sides overlap, songs are replaced one by one */
+	for (i = 0; i < common; i++) {
+		add_local(songs[i], position + i);
+	}
+
+	/* Old songs left over are removed in one pass */
+	if (count > common) {
+		positions.reserve(count - common);
+		for (i = position + common; i < position + count; i++) {
+			positions.push_back(i);
+		}
+		remove_local(positions);
+		return;
+	}
+
+	if (songs.size() == common) {
+		return;
+	}
+
+	/* New songs left over are inserted in one go */
+	inserted.reserve(songs.size() - common);
+	for (i = common; i < songs.size(); i++) {
+		inserted.push_back(new ListItemSong(this, songs[i], MPD_SONG_NO_ID));
+		add_song_length(songs[i]->time);
+	}
+
+	items.insert(items.begin() + position + common, inserted.begin(), inserted.end());
+
+	/* Renumber the songs which moved up */
+	for (i = position + common; i < size(); i++) {
+		typed(items[i])->pos = i;
+	}
+
+	items_changed();
+}
+
 bool
 Songlist::remove(ListItem * i)
 {
-	ListItemSong * list_item = LISTITEMSONG(i);
+	ListItemSong * list_item = typed(i);
 
 	assert(list_item);
 	assert(list_item->song);
-	assert(list_item->song->pos != MPD_SONG_NO_NUM);
-	assert(list_item->song->pos < size());
+	assert(list_item->pos != MPD_SONG_NO_NUM);
+	assert(list_item->pos < size());
+
+	remove_local(list_item->pos);
+
+	return true;
+}
+
+bool
+Songlist::remove_items(const vector<ListItem *> & items)
+{
+	vector<ListItem *>::const_iterator	iter;
+	vector<uint32_t>			positions;
+
+	positions.reserve(items.size());
+	for (iter = items.begin(); iter != items.end(); ++iter) {
+		positions.push_back(typed(*iter)->pos);
+	}
+
+	std::sort(positions.begin(), positions.end());
+	positions.erase(std::unique(positions.begin(), positions.end()), positions.end());
 
-	remove_local(list_item->song->pos);
+	remove_local(positions);
 
 	return true;
 }
 
+void
+Songlist::items_changed()
+{
+	List::items_changed();
+	columns_valid_ = false;
+}
+
+void
+Songlist::build_columns()
+{
+	vector<ListItem *>::iterator	iter;
+	ListItemSong *			list_item;
+	unsigned int			i;
+
+	if (columns_valid_ && columns_revision_ == Song::revision()) {
+		return;
+	}
+
+	song_column.resize(size());
+	id_column.resize(size());
+	time_column.resize(size());
+
+	for (iter = items.begin(), i = 0; iter != items.end(); ++iter, ++i) {
+		list_item = typed(*iter);
+		song_column[i] = list_item->song;
+		id_column[i] = list_item->id;
+		time_column[i] = list_item->song->time;
+	}
+
+	for (i = 0; i < MATCH_FIELDS; i++) {
+		tag_columns[i].clear();
+	}
+
+	columns_valid_ = true;
+	columns_revision_ = Song::revision();
+}
+
+const vector<const string *> &
+Songlist::tag_column(long field)
+{
+	Tag Song::*		member;
+	unsigned int		index = 0;
+	unsigned int		i;
+
+	member = Song::tag_member(field);
+	assert(member);
+
+	while (!(field & (1 << index))) {
+		++index;
+	}
+
+	build_columns();
+
+	if (tag_columns[index].size() != size()) {
+		tag_columns[index].resize(size());
+		for (i = 0; i < size(); i++) {
+			tag_columns[index][i] = &(song_column[i]->*member).str();
+		}
+	}
+
+	return tag_columns[index];
+}
+
+const vector<const string *> *
+Songlist::match_column(long flags)
+{
+	long	field;
+
+	build_columns();
+
+	/* A search on a single tag only needs to look at that tag's column */
+	field = flags & MATCH_ALL;
+	if (field && !(field & (field - 1)) && Song::tag_member(field)
+			&& !(flags & (MATCH_LT | MATCH_LTE | MATCH_GT | MATCH_GTE))) {
+		return &tag_column(field);
+	}
+
+	return NULL;
+}
+
+ListItem *
+Songlist::match(string pattern, unsigned int from, unsigned int to, long flags)
+{
+	const vector<const string *> *	column;
+	bool				matched;
+	int				i;
+
+	if (!size()) {
+		return NULL;
+	}
+
+	assert(from < size());
+	assert(to < size());
+
+	column = match_column(flags);
+	Matcher matcher = Song::matcher(pattern, flags);
+
+	i = from;
+
+	while (true)
+	{
+		if (i < 0) {
+			i = size() - 1;
+		} else if (i >= size()) {
+			i = 0;
+		}
+
+		if (column) {
+			matched = (matcher.match(*(*column)[i]) != !!(flags & MATCH_NOT));
+		} else {
+			matched = song_column[i]->match(matcher, flags, id_column[i], i);
+		}
+
+		if (matched) {
+			return items[i];
+		}
+
+		if (i == to) {
+			break;
+		}
+
+		i += (flags & MATCH_REVERSE ? -1 : 1);
+	}
+
+	return NULL;
+}
+
+unsigned int
+Songlist::match_all(const string & pattern, unsigned int from, long flags, vector<Song *> & songs)
+{
+	const vector<const string *> *	column;
+	unsigned int			count;
+	unsigned int			i;
+	bool				matched;
+
+	count = songs.size();
+
+	if (from >= size()) {
+		return 0;
+	}
+
+	column = match_column(flags);
+	Matcher matcher = Song::matcher(pattern, flags);
+
+	for (i = from; i < size(); i++) {
+		if (column) {
+			matched = (matcher.match(*(*column)[i]) != !!(flags & MATCH_NOT));
+		} else {
+			matched = song_column[i]->match(matcher, flags, id_column[i], i);
+		}
+		if (matched) {
+			songs.push_back(song_column[i]);
+		}
+	}
+
+	return songs.size() - count;
+}
+
 /*
  * Set selection state of a song
  *
@@ -494,7 +785,7 @@ unsigned int		Songlist::qlength()
 	unsigned int		i, songpos;
 
 	/* Find current playing song */
-	if (!pms->cursong() || pms->cursong()->id == MPD_SONG_NO_ID || pms->cursong()->pos == MPD_SONG_NO_NUM)
+	if (!pms->cursong() || pms->cursong_id() == MPD_SONG_NO_ID || pms->cursong_pos() == MPD_SONG_NO_NUM)
 	{
 		qnum = size();
 		qpos = 0;
@@ -502,21 +793,22 @@ unsigned int		Songlist::qlength()
 		return qlen;
 	}
 
-	if ((int)qpos == pms->cursong()->id && qsize == size()) {
+	if ((int)qpos == pms->cursong_id() && qsize == size()) {
 		return qlen;
 	}
 
-	qpos = pms->cursong()->id;
-	songpos = pms->cursong()->pos;
+	qpos = pms->cursong_id();
+	songpos = pms->cursong_pos();
 
 	/* Calculate from start */
 	qlen = 0;
 	qnum = 0;
 	qsize = size();
+	build_columns();
 	for (i = songpos + 1; i < size(); i++)
 	{
-		if (song(i)->time != MPD_SONG_NO_TIME)
-			qlen += song(i)->time;
+		if (time_column[i] != MPD_SONG_NO_TIME)
+			qlen += time_column[i];
 		++qnum;
 	}
 	return qlen;
@@ -570,9 +862,10 @@ Songlist::set_column_size()
 	winlen = bbox->width();
 
 	/* Find minimum length needed to display all content */
+	build_columns();
 	for (i = 0; i < size(); i++)
 	{
-		s = song(i);
+		s = song_column[i];
 
 		for (j = 0; j < columns.size(); j++)
 		{
@@ -581,7 +874,7 @@ Songlist::set_column_size()
 			switch(columns[j]->type)
 			{
 			case FIELD_NUM:
-				ui = Pms::tostring(s->pos).size();
+				ui = Pms::tostring(static_cast<long>(i)).size();
 				break;
 			case FIELD_FILE:
 				ui = s->file.size();
@@ -698,7 +991,8 @@ Songlist::draw()
 	unsigned int		min;
 	unsigned int		max;
 	int			ii;
-	ListItem *		list_item;
+	bool			is_queue;
+	ListItemSong *		list_item;
 	Song *			s;
 	string			t;
 	color *			hilight;
@@ -716,14 +1010,16 @@ Songlist::draw()
 	min = top_position();
 	max = bottom_position();
 
+	is_queue = (QUEUE(this) != NULL);
+
 	/* Traverse song list and draw lines */
 	for (i = min; i <= max; i++)
 	{
 		++counter;
 		hilight = NULL;
 
-		list_item = item(i);
-		s = song(i);
+		list_item = song_item(i);
+		s = list_item->song;
 		assert(s);
 
 		if (i == cursor_position)
@@ -735,7 +1031,7 @@ Songlist::draw()
 			hilight = pms->options->colors->selection;
 		}
 		else if (pms->cursong()) {
-                        if ((QUEUE(this) && pms->cursong()->id == s->id) || (!QUEUE(this) && s->file == pms->cursong()->file)) {
+                        if ((is_queue && pms->cursong_id() == list_item->id) || (!is_queue && s == pms->cursong())) {
 				hilight = pms->options->colors->current;
 			}
 		}
@@ -753,7 +1049,12 @@ Songlist::draw()
 			c = pms->formatter->getcolor(columns[j]->type, &(pms->options->colors->fields));
 			if (c)
 			{
-				t = pms->formatter->format(s, columns[j]->type);
+				/* Positions are not part of the song itself */
+				if (columns[j]->type == FIELD_NUM) {
+					t = Pms::tostring(static_cast<long>(i));
+				} else {
+					t = pms->formatter->format(s, columns[j]->type);
+				}
 				colprint(bbox, counter, (j == 0 ? winlen : winlen + 1),
 					(hilight ? hilight : c),
 					"%s", t.c_str());
@@ -825,6 +1126,7 @@ bool		Songlist::sort(string sorts)
 	}
 
 	renumber_pos();
+	items_changed();
 
 	delete v;
 	return true;
@@ -837,8 +1139,8 @@ Songlist::renumber_pos()
 	uint32_t i;
 
 	for (i = 0; i < size(); i++) {
-		list_item = LISTITEMSONG(items[i]);
-		list_item->song->pos = i;
+		list_item = typed(items[i]);
+		list_item->pos = i;
 	}
 }
 
@@ -903,11 +1205,20 @@ bool	icstrsort(const string & a, const string & b)
 
 /*
  * Sort functions
+ *
+ * These are only ever called on the items of a Songlist, which are all
+ * ListItemSong, so no runtime type check is needed.
  */
+static inline Song *
+sort_song(ListItem * it)
+{
+	return static_cast<ListItemSong *>(it)->song;
+}
+
 bool	sort_compare_file(ListItem * a_, ListItem * b_)
 {
-	Song * a = LISTITEMSONG(a_)->song;
-	Song * b = LISTITEMSONG(b_)->song;
+	Song * a = sort_song(a_);
+	Song * b = sort_song(b_);
 	if (a == NULL && b == NULL)			return true;
 	else if (a == NULL && b != NULL)		return true;
 	else if (a != NULL && b == NULL)		return false;
@@ -916,8 +1227,8 @@ bool	sort_compare_file(ListItem * a_, ListItem * b_)
 
 bool	sort_compare_artist(ListItem * a_, ListItem * b_)
 {
-	Song * a = LISTITEMSONG(a_)->song;
-	Song * b = LISTITEMSONG(b_)->song;
+	Song * a = sort_song(a_);
+	Song * b = sort_song(b_);
 	if (a == NULL && b == NULL)			return true;
 	else if (a == NULL && b != NULL)		return true;
 	else if (a != NULL && b == NULL)		return false;
@@ -926,8 +1237,8 @@ bool	sort_compare_artist(ListItem * a_, ListItem * b_)
 
 bool	sort_compare_albumartist(ListItem * a_, ListItem * b_)
 {
-	Song * a = LISTITEMSONG(a_)->song;
-	Song * b = LISTITEMSONG(b_)->song;
+	Song * a = sort_song(a_);
+	Song * b = sort_song(b_);
 	if (a == NULL && b == NULL)			return true;
 	else if (a == NULL && b != NULL)		return true;
 	else if (a != NULL && b == NULL)		return false;
@@ -936,8 +1247,8 @@ bool	sort_compare_albumartist(ListItem * a_, ListItem * b_)
 
 bool	sort_compare_albumartistsort(ListItem * a_, ListItem * b_)
 {
-	Song * a = LISTITEMSONG(a_)->song;
-	Song * b = LISTITEMSONG(b_)->song;
+	Song * a = sort_song(a_);
+	Song * b = sort_song(b_);
 	if (a == NULL && b == NULL)			return true;
 	else if (a == NULL && b != NULL)		return true;
 	else if (a != NULL && b == NULL)		return false;
@@ -946,8 +1257,8 @@ bool	sort_compare_albumartistsort(ListItem * a_, ListItem * b_)
 
 bool	sort_compare_artistsort(ListItem * a_, ListItem * b_)
 {
-	Song * a = LISTITEMSONG(a_)->song;
-	Song * b = LISTITEMSONG(b_)->song;
+	Song * a = sort_song(a_);
+	Song * b = sort_song(b_);
 	if (a == NULL && b == NULL)			return true;
 	else if (a == NULL && b != NULL)		return true;
 	else if (a != NULL && b == NULL)		return false;
@@ -956,8 +1267,8 @@ bool	sort_compare_artistsort(ListItem * a_, ListItem * b_)
 
 bool	sort_compare_title(ListItem * a_, ListItem * b_)
 {
-	Song * a = LISTITEMSONG(a_)->song;
-	Song * b = LISTITEMSONG(b_)->song;
+	Song * a = sort_song(a_);
+	Song * b = sort_song(b_);
 	if (a == NULL && b == NULL)			return true;
 	else if (a == NULL && b != NULL)		return true;
 	else if (a != NULL && b == NULL)		return false;
@@ -966,8 +1277,8 @@ bool	sort_compare_title(ListItem * a_, ListItem * b_)
 
 bool	sort_compare_album(ListItem * a_, ListItem * b_)
 {
-	Song * a = LISTITEMSONG(a_)->song;
-	Song * b = LISTITEMSONG(b_)->song;
+	Song * a = sort_song(a_);
+	Song * b = sort_song(b_);
 	if (a == NULL && b == NULL)			return true;
 	else if (a == NULL && b != NULL)		return true;
 	else if (a != NULL && b == NULL)		return false;
@@ -976,18 +1287,18 @@ bool	sort_compare_album(ListItem * a_, ListItem * b_)
 
 bool	sort_compare_track(ListItem * a_, ListItem * b_)
 {
-	Song * a = LISTITEMSONG(a_)->song;
-	Song * b = LISTITEMSONG(b_)->song;
+	Song * a = sort_song(a_);
+	Song * b = sort_song(b_);
 	if (a == NULL && b == NULL)			return true;
 	else if (a == NULL && b != NULL)		return true;
 	else if (a != NULL && b == NULL)		return false;
-	else 						return atoi(a->track.c_str()) < atoi(b->track.c_str());
+	else 						return a->tracknum < b->tracknum;
 }
 
 bool	sort_compare_length(ListItem * a_, ListItem * b_)
 {
-	Song * a = LISTITEMSONG(a_)->song;
-	Song * b = LISTITEMSONG(b_)->song;
+	Song * a = sort_song(a_);
+	Song * b = sort_song(b_);
 	if (a == NULL && b == NULL)			return true;
 	else if (a == NULL && b != NULL)		return true;
 	else if (a != NULL && b == NULL)		return false;
@@ -996,8 +1307,8 @@ bool	sort_compare_length(ListItem * a_, ListItem * b_)
 
 bool	sort_compare_name(ListItem * a_, ListItem * b_)
 {
-	Song * a = LISTITEMSONG(a_)->song;
-	Song * b = LISTITEMSONG(b_)->song;
+	Song * a = sort_song(a_);
+	Song * b = sort_song(b_);
 	if (a == NULL && b == NULL)			return true;
 	else if (a == NULL && b != NULL)		return true;
 	else if (a != NULL && b == NULL)		return false;
@@ -1006,8 +1317,8 @@ bool	sort_compare_name(ListItem * a_, ListItem * b_)
 
 bool	sort_compare_date(ListItem * a_, ListItem * b_)
 {
-	Song * a = LISTITEMSONG(a_)->song;
-	Song * b = LISTITEMSONG(b_)->song;
+	Song * a = sort_song(a_);
+	Song * b = sort_song(b_);
 	if (a == NULL && b == NULL)			return true;
 	else if (a == NULL && b != NULL)		return true;
 	else if (a != NULL && b == NULL)		return false;
@@ -1016,18 +1327,18 @@ bool	sort_compare_date(ListItem * a_, ListItem * b_)
 
 bool	sort_compare_year(ListItem * a_, ListItem * b_)
 {
-	Song * a = LISTITEMSONG(a_)->song;
-	Song * b = LISTITEMSONG(b_)->song;
+	Song * a = sort_song(a_);
+	Song * b = sort_song(b_);
 	if (a == NULL && b == NULL)			return true;
 	else if (a == NULL && b != NULL)		return true;
 	else if (a != NULL && b == NULL)		return false;
-	else 						return a->year < b->year;
+	else 						return a->yearnum < b->yearnum;
 }
 
 bool	sort_compare_genre(ListItem * a_, ListItem * b_)
 {
-	Song * a = LISTITEMSONG(a_)->song;
-	Song * b = LISTITEMSONG(b_)->song;
+	Song * a = sort_song(a_);
+	Song * b = sort_song(b_);
 	if (a == NULL && b == NULL)			return true;
 	else if (a == NULL && b != NULL)		return true;
 	else if (a != NULL && b == NULL)		return false;
@@ -1036,8 +1347,8 @@ bool	sort_compare_genre(ListItem * a_, ListItem * b_)
 
 bool	sort_compare_composer(ListItem * a_, ListItem * b_)
 {
-	Song * a = LISTITEMSONG(a_)->song;
-	Song * b = LISTITEMSONG(b_)->song;
+	Song * a = sort_song(a_);
+	Song * b = sort_song(b_);
 	if (a == NULL && b == NULL)			return true;
 	else if (a == NULL && b != NULL)		return true;
 	else if (a != NULL && b == NULL)		return false;
@@ -1046,8 +1357,8 @@ bool	sort_compare_composer(ListItem * a_, ListItem * b_)
 
 bool	sort_compare_performer(ListItem * a_, ListItem * b_)
 {
-	Song * a = LISTITEMSONG(a_)->song;
-	Song * b = LISTITEMSONG(b_)->song;
+	Song * a = sort_song(a_);
+	Song * b = sort_song(b_);
 	if (a == NULL && b == NULL)			return true;
 	else if (a == NULL && b != NULL)		return true;
 	else if (a != NULL && b == NULL)		return false;
@@ -1056,18 +1367,18 @@ bool	sort_compare_performer(ListItem * a_, ListItem * b_)
 
 bool	sort_compare_disc(ListItem * a_, ListItem * b_)
 {
-	Song * a = LISTITEMSONG(a_)->song;
-	Song * b = LISTITEMSONG(b_)->song;
+	Song * a = sort_song(a_);
+	Song * b = sort_song(b_);
 	if (a == NULL && b == NULL)			return true;
 	else if (a == NULL && b != NULL)		return true;
 	else if (a != NULL && b == NULL)		return false;
-	else 						return atoi(a->disc.c_str()) < atoi(b->disc.c_str());
+	else 						return a->discnum < b->discnum;
 }
 
 bool	sort_compare_comment(ListItem * a_, ListItem * b_)
 {
-	Song * a = LISTITEMSONG(a_)->song;
-	Song * b = LISTITEMSONG(b_)->song;
+	Song * a = sort_song(a_);
+	Song * b = sort_song(b_);
 	if (a == NULL && b == NULL)			return true;
 	else if (a == NULL && b != NULL)		return true;
 	else if (a != NULL && b == NULL)		return false;
@@ -1080,7 +1391,7 @@ Songlist::crop_to_song(Song * song)
 	vector<ListItem *>::reverse_iterator iter;
 	ListItem * it;
 
-	it = match(song->file, 0, size() - 1, MATCH_FILE | MATCH_EXACT);
+	it = find(song);
 
 	if (!it) {
 		return false;
@@ -1091,8 +1402,7 @@ Songlist::crop_to_song(Song * song)
 		if (*iter == it) {
 			continue;
 		}
-		assert(LISTITEMSONG(*iter));
-		if (!remove(LISTITEMSONG(*iter))) {
+		if (!remove(*iter)) {
 			/* FIXME: error reporting */
 			return false;
 		}
@@ -67,6 +67,7 @@ enum
 	MATCH_YEAR		= 1 << 17,
 
 	MATCH_ALL		= (1 << 18) - 1,
+	MATCH_FIELDS		= 18,
 
 	MATCH_NOT		= 1 << 18,
 	MATCH_EXACT		= 1 << 19,
@@ -89,13 +90,28 @@ class ListItemSong : public ListItem
 public:
 	Song *		song;
 
-			ListItemSong(List * l, Song * s);
+	/* Position of this item in its list, and MPD queue id */
+	song_t		pos;
+	song_t		id;
+
+	/**
+	 * Create a list item for a song. The list item takes over one
+	 * reference to the song, and releases it when destroyed.
+	 */
+			ListItemSong(List * l, Song * s, song_t song_id = MPD_SONG_NO_ID);
 			~ListItemSong();
 
+	/**
+	 * List items are allocated from a shared slab, like songs.
+	 */
+	static void *	operator new(size_t size);
+	static void	operator delete(void * ptr);
+	static Slab &	slab();
+
 	bool		match(string term, long flags);
 };
 
-class Songlist : public List
+class Songlist : public TypedList<ListItemSong>
 {
 private:
 	song_t					position;
@@ -106,6 +122,37 @@ private:
 
 	vector<pms_column *>			columns;
 
+	/*
+	 * Column-oriented copy of the list contents, with one entry per list
+	 * item in list order. The song, id and time columns are rebuilt
+	 * whenever the list has changed and a scan needs them. Tag columns
+	 * point into the tag pool, and are only built for the fields that are
+	 * actually scanned.
+	 */
+	vector<Song *>				song_column;
+	vector<song_t>				id_column;
+	vector<int>				time_column;
+	vector<const string *>			tag_columns[MATCH_FIELDS];
+	bool					columns_valid_;
+	unsigned long				columns_revision_;
+
+	/*
+	 * Bring the song, id and time columns up to date with the list items.
+	 */
+	void			build_columns();
+
+	/*
+	 * Return the tag column for a single MATCH_* tag field, building it
+	 * if needed.
+	 */
+	const vector<const string *> &	tag_column(long field);
+
+	/*
+	 * Return the tag column to search for the given MATCH_* flags, or
+	 * NULL if the whole song must be matched.
+	 */
+	const vector<const string *> *	match_column(long flags);
+
 protected:
 	/*
 	 * Appends a songlist to the list.
@@ -114,12 +161,37 @@ protected:
 	 */
 	song_t			add_local(Songlist *);
 
+	/*
+	 * Invalidate the column store.
+	 */
+	void			items_changed();
+
 	/*
 	 * Remove song in position N from the list.
 	 */
 	void			remove_local(uint32_t position);
 
+	/*
+	 * Remove the songs at a set of positions, given in strictly
+	 * ascending order, in a single pass over the list.
+	 */
+	void			remove_local(const vector<uint32_t> & positions);
+
 public:
+	/*
+	 * Move the songs at a set of positions, given in strictly ascending
+	 * order, by 'offset' places, in a single pass over the list.
+	 */
+	void			move_local(const vector<uint32_t> & positions, int32_t offset);
+
+	/*
+	 * Replace 'count' songs starting at 'position' with a sequence of
+	 * songs, which may be of a different length. Songs outside the span
+	 * keep their list items. The list takes over one reference to each
+	 * song.
+	 */
+	void			replace_local(uint32_t position, uint32_t count, const vector<Song *> & songs);
+
 				Songlist();
 				~Songlist();
 
@@ -128,9 +200,26 @@ public:
 	bool			draw();
 
 	/**
-	 * Return the first occurrence of a song.
+	 * Find matching song in the range from..to. Searches on a single tag
+	 * field are a linear pass over that field's column.
+	 *
+	 * Returns a ListItem pointer if a match was found, or NULL if no match.
+	 */
+	ListItem *		match(string pattern, unsigned int from, unsigned int to, long flags);
+
+	/**
+	 * Collect every matching song from position 'from' to the end of the
+	 * list, in list order, in a single pass.
+	 *
+	 * Returns the number of songs appended to 'songs'.
 	 */
-	ListItemSong *		find(Song *);
+	unsigned int		match_all(const string & pattern, unsigned int from, long flags, vector<Song *> & songs);
+
+	/**
+	 * Return the first occurrence of a song. In the queue, the song
+	 * is looked up by its queue id if one is given.
+	 */
+	ListItemSong *		find(Song *, song_t id = MPD_SONG_NO_ID);
 
 	/**
 	 * Return the song at the specified position.
@@ -139,6 +228,13 @@ public:
 	 */
 	Song *			song(uint32_t position);
 
+	/**
+	 * Return the list item at the specified position.
+	 *
+	 * Will raise an assertion error when the position is invalid.
+	 */
+	ListItemSong *		song_item(uint32_t position);
+
 	/**
 	 * Crop the list to a specific song.
 	 *
@@ -154,8 +250,8 @@ public:
 	bool			sort(string);
 
 	/**
-	 * After a sort procedure, the song->pos are inaccurate. This function
-	 * numbers them sequentially.
+	 * After a sort procedure, the list item positions are inaccurate.
+	 * This function numbers them sequentially.
 	 */
 	void			renumber_pos();
 
@@ -166,10 +262,10 @@ public:
 	bool			swap(uint32_t, uint32_t);
 
 	/* Pick songs based on playmode */
-	Song *			next_song_in_direction(Song * s, uint8_t direction, song_t * id);
-	Song *			nextsong(song_t * = NULL);
-	Song *			prevsong(song_t * = NULL);
-	Song *			randsong(song_t * = NULL);
+	ListItemSong *		next_song_in_direction(Song * s, song_t s_pos, uint8_t direction, song_t * id);
+	ListItemSong *		nextsong(song_t * = NULL);
+	ListItemSong *		prevsong(song_t * = NULL);
+	ListItemSong *		randsong(song_t * = NULL);
 
 	/* Next-of and prev-of functions */
 	song_t			nextof(string);
@@ -189,14 +285,14 @@ public:
 
 	/*
 	 * Adds or replaces a song to the list, depending on the value of
-	 * song->pos. The latter value is asserted to less than or equal to the
-	 * list size.
+	 * pos. The latter value is asserted to less than or equal to the
+	 * list size. The list takes over one reference to the song.
 	 *
 	 * FIXME: this function should be protected!
 	 *
 	 * Returns the zero-indexed position of the added song.
 	 */
-	song_t			add_local(Song * s);
+	song_t			add_local(Song * s, song_t pos = MPD_SONG_NO_NUM, song_t id = MPD_SONG_NO_ID);
 
 	/**
 	 * Remove a song asynchronously, i.e. send a message to MPD and request
@@ -205,6 +301,12 @@ public:
 	 */
 	bool			remove(ListItem * i);
 
+	/**
+	 * Remove several songs from the list in one pass. Subclasses which
+	 * override remove() must override this as well.
+	 */
+	bool			remove_items(const vector<ListItem *> & items);
+
 	/**
 	 * Add a song length to the list's cached length.
 	 */
@@ -0,0 +1,180 @@
+/* vi:set ts=8 sts=8 sw=8 noet:
+ *
+ * PMS	<<Practical Music Search>>
+ * Copyright (C) 2006-2015  Kim Tore Jensen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * tag.cpp
+ * 	interned, immutable tag strings shared between songs
+ */
+
+#include <assert.h>
+
+#include "tag.h"
+
+static const string	empty_tag;
+
+
+/*
+ * Tag pool
+ */
+Tagpool::Tagpool()
+{
+	referenced_bytes_ = 0;
+	stored_bytes_ = 0;
+	references_ = 0;
+}
+
+Tagpool::entry *
+Tagpool::acquire(const string & value)
+{
+	pair<container::iterator, bool> result;
+
+	result = entries.insert(entry(value, 0));
+
+	if (result.second) {
+		stored_bytes_ += value.size();
+	}
+
+	retain(&(*result.first));
+
+	return &(*result.first);
+}
+
+void
+Tagpool::retain(entry * e)
+{
+	assert(e);
+
+	++e->second;
+	++references_;
+	referenced_bytes_ += e->first.size();
+}
+
+void
+Tagpool::release(entry * e)
+{
+	container::iterator iter;
+
+	assert(e);
+	assert(e->second > 0);
+
+	--references_;
+	referenced_bytes_ -= e->first.size();
+
+	if (--e->second > 0) {
+		return;
+	}
+
+	stored_bytes_ -= e->first.size();
+
+	iter = entries.find(e->first);
+	assert(iter != entries.end());
+	entries.erase(iter);
+}
+
+
+/*
+ * Tag handle
+ */
+Tag::Tag()
+{
+	entry_ = NULL;
+}
+
+Tag::Tag(const string & value)
+{
+	entry_ = NULL;
+	assign(value);
+}
+
+Tag::Tag(const char * value)
+{
+	entry_ = NULL;
+	assign(value ? value : "");
+}
+
+Tag::Tag(const Tag & src)
+{
+	entry_ = src.entry_;
+	if (entry_) {
+		pool().retain(entry_);
+	}
+}
+
+Tag::~Tag()
+{
+	if (entry_) {
+		pool().release(entry_);
+	}
+}
+
+Tagpool &
+Tag::pool()
+{
+	static Tagpool p;
+	return p;
+}
+
+/*
+ * Point this handle at the pool entry for a new value.
+ */
+void
+Tag::assign(const string & value)
+{
+	Tagpool::entry * old = entry_;
+
+	entry_ = (value.size() ? pool().acquire(value) : NULL);
+
+	/* Release after acquiring, in case both are the same entry */
+	if (old) {
+		pool().release(old);
+	}
+}
+
+Tag &
+Tag::operator=(const Tag & src)
+{
+	if (src.entry_) {
+		pool().retain(src.entry_);
+	}
+	if (entry_) {
+		pool().release(entry_);
+	}
+	entry_ = src.entry_;
+
+	return *this;
+}
+
+Tag &
+Tag::operator=(const string & value)
+{
+	assign(value);
+	return *this;
+}
+
+Tag &
+Tag::operator=(const char * value)
+{
+	assign(value ? value : "");
+	return *this;
+}
+
+const string &
+Tag::str() const
+{
+	return (entry_ ? entry_->first : empty_tag);
+}
@@ -0,0 +1,154 @@
+/* vi:set ts=8 sts=8 sw=8 noet:
+ *
+ * PMS	<<Practical Music Search>>
+ * Copyright (C) 2006-2015  Kim Tore Jensen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * tag.h
+ * 	interned, immutable tag strings shared between songs
+ */
+
+#ifndef _PMS_TAG_H_
+#define _PMS_TAG_H_
+
+#include <string>
+#include <unordered_map>
+#include <stddef.h>
+
+using namespace std;
+
+
+/**
+ * Global pool of interned tag values. Each distinct string is stored once,
+ * together with the number of Tag handles referring to it. Entries are
+ * removed when their last handle goes away.
+ */
+class Tagpool
+{
+public:
+	typedef unordered_map<string, unsigned long>	container;
+	typedef container::value_type			entry;
+
+private:
+	container		entries;
+
+	/* Sum of string lengths over all references and over all unique
+	 * entries, respectively. The difference is what sharing saves. */
+	unsigned long		referenced_bytes_;
+	unsigned long		stored_bytes_;
+	unsigned long		references_;
+
+public:
+				Tagpool();
+
+	/**
+	 * Return the pool entry for a string, creating it if needed, and add
+	 * a reference to it.
+	 */
+	entry *			acquire(const string & value);
+
+	/**
+	 * Add a reference to an existing entry.
+	 */
+	void			retain(entry * e);
+
+	/**
+	 * Drop a reference to an entry, and remove it when unreferenced.
+	 */
+	void			release(entry * e);
+
+	/**
+	 * Number of distinct strings in the pool.
+	 */
+	unsigned long		size() const { return entries.size(); };
+
+	/**
+	 * Number of live Tag handles referring to pooled strings.
+	 */
+	unsigned long		references() const { return references_; };
+
+	/**
+	 * Bytes of string data actually stored by the pool.
+	 */
+	unsigned long		stored_bytes() const { return stored_bytes_; };
+
+	/**
+	 * Bytes of string data that would have been stored without interning,
+	 * minus what is actually stored.
+	 */
+	unsigned long		saved_bytes() const { return referenced_bytes_ - stored_bytes_; };
+};
+
+
+/**
+ * Handle to an interned, immutable string. Copying a Tag only copies a
+ * pointer, and two Tags are equal if and only if they point to the same pool
+ * entry. The empty string is represented without a pool entry.
+ */
+class Tag
+{
+private:
+	Tagpool::entry *	entry_;
+
+	void			assign(const string & value);
+
+public:
+				Tag();
+				Tag(const string & value);
+				Tag(const char * value);
+				Tag(const Tag & src);
+				~Tag();
+
+	/**
+	 * The process-wide tag pool.
+	 */
+	static Tagpool &	pool();
+
+	Tag &			operator=(const Tag & src);
+	Tag &			operator=(const string & value);
+	Tag &			operator=(const char * value);
+
+	const string &		str() const;
+				operator const string &() const { return str(); };
+	const char *		c_str() const { return str().c_str(); };
+	size_t			size() const { return str().size(); };
+	bool			empty() const { return entry_ == NULL; };
+
+	string			substr(size_t pos, size_t n = string::npos) const { return str().substr(pos, n); };
+
+	/**
+	 * Handle-based hash, suitable for hashed containers keyed on Tag.
+	 */
+	size_t			hash() const { return reinterpret_cast<size_t>(entry_); };
+
+	bool			operator==(const Tag & other) const { return entry_ == other.entry_; };
+	bool			operator!=(const Tag & other) const { return entry_ != other.entry_; };
+	bool			operator==(const string & other) const { return str() == other; };
+	bool			operator!=(const string & other) const { return str() != other; };
+	bool			operator==(const char * other) const { return str() == other; };
+	bool			operator!=(const char * other) const { return str() != other; };
+	bool			operator<(const Tag & other) const { return str() < other.str(); };
+};
+
+inline bool		operator==(const string & a, const Tag & b) { return b == a; }
+inline bool		operator!=(const string & a, const Tag & b) { return b != a; }
+
+struct TagHash
+{
+	size_t			operator()(const Tag & t) const { return t.hash(); };
+};
+
+#endif /* _PMS_TAG_H_ */
@@ -46,6 +46,7 @@ typedef enum
 	PEND_QUIT,
 	PEND_SHELL,
 	PEND_SHOW_INFO,
+	PEND_MEMSTATS,
 
 	PEND_PASSWORD,
 	PEND_UPDATE_DB,
@@ -0,0 +1,1867 @@
+/* vi:set ts=8 sts=8 sw=8 noet:
+ *
+ * PMS	<<Practical Music Search>>
+ * Copyright (C) 2006-2015  Kim Tore Jensen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * fakempd.cpp
+ * 	stand-in MPD server with a synthetic library, for testing PMS offline
+ *
+ * Speaks the subset of the MPD protocol that PMS uses: the database listings,
+ * status and stats, IDLE, the queue and stored playlist commands, and the
+ * player controls. The library is generated from the song count alone, so a
+ * million songs cost no memory until they are put in a list. Every response
+ * can be delayed to simulate a slow server or network.
+ *
+ * Usage: fakempd [--port N] [--bind ADDRESS] [--songs N] [--latency-ms M]
+ *                [--password PASSWORD]
+ */
+
+#include <algorithm>
+#include <deque>
+#include <functional>
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+using namespace std;
+
+#define PROTOCOL_VERSION	"0.24.0"
+
+#define SONGS_PER_ALBUM		10
+#define ALBUMS_PER_ARTIST	10
+#define SONGS_PER_ARTIST	(SONGS_PER_ALBUM * ALBUMS_PER_ARTIST)
+#define MAX_SONGS		10000000
+
+#define OUTPUT_CHUNK_SIZE	65536	/* bytes generated ahead of the socket */
+#define MAX_LINE_LENGTH		65536	/* longest command accepted */
+
+/* Modification time of every song in the library */
+#define SONG_MTIME		"2015-01-01T00:00:00Z"
+
+/* Error codes from MPD's protocol */
+#define ACK_ERROR_ARG		2
+#define ACK_ERROR_PASSWORD	3
+#define ACK_ERROR_UNKNOWN	5
+#define ACK_ERROR_NO_EXIST	50
+#define ACK_ERROR_EXIST		56
+
+/* IDLE subsystems */
+#define EVENT_DATABASE		0x01
+#define EVENT_STORED_PLAYLIST	0x02
+#define EVENT_PLAYLIST		0x04
+#define EVENT_PLAYER		0x08
+#define EVENT_MIXER		0x10
+#define EVENT_OUTPUT		0x20
+#define EVENT_OPTIONS		0x40
+#define EVENT_UPDATE		0x80
+#define EVENT_ALL		0xff
+
+static const char * event_names[] = {
+	"database", "stored_playlist", "playlist", "player",
+	"mixer", "output", "options", "update", NULL
+};
+
+static const char * genres[] = {
+	"Ambient", "Blues", "Classical", "Electronic",
+	"Folk", "Jazz", "Metal", "Rock"
+};
+
+typedef vector<string>			arguments;
+
+/*
+ * Produces more output when called, and returns true if there is more to
+ * come. Large listings are generated piecemeal as the client reads them.
+ */
+typedef function<bool(string &)>	generator;
+
+
+/*
+ * Output of one command or command list, sent once it is due.
+ */
+struct Response
+{
+	long long			due;
+	deque<generator>		parts;
+	string				buffer;
+	size_t				offset;
+
+	bool				close_after;
+};
+
+struct Client
+{
+	int				fd;
+	string				input;
+	deque<Response>			output;
+	bool				closing;
+
+	/* Inside command_list_begin ... command_list_end */
+	bool				in_list;
+	bool				list_ok;
+	vector<arguments>		list;
+
+	/* Waiting in IDLE for any of the subsystems in idle_mask */
+	bool				idle;
+	unsigned int			idle_mask;
+	unsigned int			events;
+};
+
+struct Queueentry
+{
+	uint32_t			song;
+	uint32_t			id;
+	uint32_t			version;
+};
+
+struct Storedplaylist
+{
+	vector<uint32_t>		songs;
+	time_t				modified;
+};
+
+/*
+ * Output of a command being run. Plain text is collected, and a generator
+ * can be appended for output that is too large to build in one go.
+ */
+class Reply
+{
+private:
+	deque<generator>		parts;
+	string				text;
+
+public:
+	void				print(const char * format, ...);
+	void				append(const string & s) { text += s; };
+	void				stream(generator more);
+	void				finish(Response & response);
+};
+
+class Server
+{
+private:
+	/* Options */
+	uint32_t			songs;
+	long				latency_ms;
+	string				password;
+
+	int				listener;
+	list<Client *>			clients;
+
+	/* Database */
+	time_t				started;
+	time_t				db_update;
+	unsigned long			db_playtime;
+	int				update_job;
+
+	/* Queue */
+	vector<Queueentry>		queue;
+	uint32_t			queue_version;
+	uint32_t			next_id;
+
+	/* Stored playlists by name */
+	map<string, Storedplaylist>	playlists;
+
+	/* Player */
+	enum { STOPPED, PLAYING, PAUSED } state;
+	int				current;
+	long long			elapsed_ms;
+	long long			resumed;
+	int				volume;
+	bool				repeat;
+	bool				random;
+	bool				single;
+	bool				consume;
+	int				crossfade;
+
+	/* Error from the last failed command */
+	int				ack_code;
+	string				ack_message;
+
+	bool				fail(int code, const char * format, ...);
+
+	/* Library */
+	string				song_uri(uint32_t n) const;
+	int				song_duration(uint32_t n) const;
+	void				print_song(string & out, uint32_t n) const;
+	bool				parse_song(const string & uri, uint32_t & n) const;
+	bool				parse_directory(const string & uri, uint32_t & first, uint32_t & last) const;
+	bool				resolve(const string & uri, uint32_t & first, uint32_t & last);
+	generator			list_tree(uint32_t first, uint32_t last, bool meta) const;
+
+	/* Queue and player state */
+	void				queue_changed(uint32_t from);
+	void				queue_insert(uint32_t pos, const vector<uint32_t> & entries);
+	void				queue_erase(uint32_t first, uint32_t last);
+	void				queue_move(uint32_t first, uint32_t last, uint32_t to);
+	int				find_id(uint32_t id) const;
+	void				print_entry(string & out, uint32_t pos) const;
+	long long			elapsed() const;
+	void				start_song(int pos, long long offset);
+	void				advance();
+	long long			next_deadline() const;
+
+	/* Stored playlists */
+	Storedplaylist *		find_playlist(const string & name);
+	void				touch_playlist(Storedplaylist & playlist);
+
+	/* Argument parsing */
+	bool				parse_number(const string & s, uint32_t & n);
+	bool				parse_range(const string & s, uint32_t size, uint32_t & first, uint32_t & last);
+	bool				parse_bool(const string & s, bool & value);
+	bool				parse_name(const string & s);
+
+	/* Protocol */
+	void				broadcast(unsigned int events);
+	void				finish_idle(Client * client);
+	void				respond(Client * client, Reply & reply, bool close_after);
+	void				handle_line(Client * client, const string & line);
+	void				run_commands(Client * client, const vector<arguments> & commands, bool list_ok);
+	bool				run(const arguments & args, Reply & reply);
+
+	/* Network */
+	void				accept_client();
+	bool				read_client(Client * client);
+	bool				write_client(Client * client);
+
+public:
+					Server(uint32_t songs, long latency_ms, const string & password);
+
+	bool				listen(const char * address, int port);
+	void				loop();
+};
+
+
+static long long
+now_ms()
+{
+	struct timespec		ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static string
+iso8601(time_t t)
+{
+	char		buffer[32];
+	struct tm	tm;
+
+	gmtime_r(&t, &tm);
+	strftime(buffer, sizeof(buffer), "%Y-%m-%dT%H:%M:%SZ", &tm);
+
+	return buffer;
+}
+
+/*
+ * Split a command line into words. Arguments may be quoted, with backslash
+ * escapes inside the quotes.
+ *
+ * Returns false if the line is malformed.
+ */
+static bool
+tokenize(const string & line, arguments & args)
+{
+	string::const_iterator	it = line.begin();
+	string			word;
+
+	args.clear();
+
+	while (it != line.end()) {
+		if (*it == ' ' || *it == '\t') {
+			++it;
+			continue;
+		}
+
+		word.clear();
+
+		if (*it == '"') {
+			for (++it; it != line.end() && *it != '"'; ++it) {
+				if (*it == '\\' && ++it == line.end()) {
+					return false;
+				}
+				word += *it;
+			}
+			if (it == line.end()) {
+				return false;
+			}
+			++it;
+		} else {
+			while (it != line.end() && *it != ' ' && *it != '\t') {
+				word += *it++;
+			}
+		}
+
+		args.push_back(word);
+	}
+
+	return !args.empty();
+}
+
+
+/*
+ * Reply
+ */
+void
+Reply::print(const char * format, ...)
+{
+	char		buffer[1024];
+	va_list		ap;
+
+	va_start(ap, format);
+	vsnprintf(buffer, sizeof(buffer), format, ap);
+	va_end(ap);
+
+	text += buffer;
+}
+
+void
+Reply::stream(generator more)
+{
+	string		t;
+
+	if (!text.empty()) {
+		t.swap(text);
+		parts.push_back([t](string & out) { out += t; return false; });
+	}
+
+	parts.push_back(more);
+}
+
+void
+Reply::finish(Response & response)
+{
+	stream([](string & out) { return false; });
+	response.parts.swap(parts);
+}
+
+
+/*
+ * Server
+ */
+Server::Server(uint32_t n_songs, long n_latency_ms, const string & n_password)
+{
+	uint32_t	n;
+
+	songs = n_songs;
+	latency_ms = n_latency_ms;
+	password = n_password;
+	listener = -1;
+
+	started = time(NULL);
+	db_update = started;
+	update_job = 0;
+
+	db_playtime = 0;
+	for (n = 0; n < songs; n++) {
+		db_playtime += song_duration(n);
+	}
+
+	queue_version = 1;
+	next_id = 1;
+
+	state = STOPPED;
+	current = -1;
+	elapsed_ms = 0;
+	resumed = 0;
+	volume = 50;
+	repeat = false;
+	random = false;
+	single = false;
+	consume = false;
+	crossfade = 0;
+
+	ack_code = 0;
+}
+
+bool
+Server::fail(int code, const char * format, ...)
+{
+	char		buffer[256];
+	va_list		ap;
+
+	va_start(ap, format);
+	vsnprintf(buffer, sizeof(buffer), format, ap);
+	va_end(ap);
+
+	ack_code = code;
+	ack_message = buffer;
+
+	return false;
+}
+
+/*
+ * Songs are numbered from zero and grouped into albums and artists by their
+ * number, so URIs, tags and directories follow from the number alone.
+ */
+string
+Server::song_uri(uint32_t n) const
+{
+	char		buffer[64];
+
+	snprintf(buffer, sizeof(buffer), "artist%05u/album%06u/track%07u.flac",
+			n / SONGS_PER_ARTIST, n / SONGS_PER_ALBUM, n);
+
+	return buffer;
+}
+
+int
+Server::song_duration(uint32_t n) const
+{
+	return 120 + n % 240;
+}
+
+void
+Server::print_song(string & out, uint32_t n) const
+{
+	char		buffer[512];
+	uint32_t	album = n / SONGS_PER_ALBUM;
+	uint32_t	artist = n / SONGS_PER_ARTIST;
+
+	snprintf(buffer, sizeof(buffer),
+			"file: %s\n"
+			"Last-Modified: " SONG_MTIME "\n"
+			"Time: %d\n"
+			"duration: %d.000\n"
+			"Artist: Artist %u\n"
+			"AlbumArtist: Artist %u\n"
+			"Title: Title %u\n"
+			"Album: Album %u\n"
+			"Track: %u/%u\n"
+			"Date: %u\n"
+			"Genre: %s\n",
+			song_uri(n).c_str(),
+			song_duration(n), song_duration(n),
+			artist, artist, n, album,
+			n % SONGS_PER_ALBUM + 1, SONGS_PER_ALBUM,
+			1960 + album % 60,
+			genres[artist % (sizeof(genres) / sizeof(genres[0]))]);
+
+	out += buffer;
+}
+
+bool
+Server::parse_song(const string & uri, uint32_t & n) const
+{
+	const char *	track;
+
+	track = strstr(uri.c_str(), "/track");
+	if (track == NULL || sscanf(track, "/track%u.flac", &n) != 1) {
+		return false;
+	}
+
+	return (n < songs && song_uri(n) == uri);
+}
+
+/*
+ * Find the songs below a directory, as the range first..last-1.
+ */
+bool
+Server::parse_directory(const string & uri, uint32_t & first, uint32_t & last) const
+{
+	uint32_t	artist;
+	uint32_t	album;
+	char		buffer[64];
+
+	if (uri.empty() || uri == "/") {
+		first = 0;
+		last = songs;
+		return true;
+	}
+
+	if (sscanf(uri.c_str(), "artist%u/album%u", &artist, &album) == 2) {
+		first = album * SONGS_PER_ALBUM;
+		snprintf(buffer, sizeof(buffer), "artist%05u/album%06u", artist, album);
+	} else if (sscanf(uri.c_str(), "artist%u", &artist) == 1) {
+		first = artist * SONGS_PER_ARTIST;
+		snprintf(buffer, sizeof(buffer), "artist%05u", artist);
+	} else {
+		return false;
+	}
+
+	if (uri != buffer || first >= songs || first / SONGS_PER_ARTIST != artist) {
+		return false;
+	}
+
+	last = first + (uri.find('/') != string::npos ? SONGS_PER_ALBUM : SONGS_PER_ARTIST);
+	last = min(last, songs);
+
+	return true;
+}
+
+/*
+ * Find the songs a URI refers to, which is either one song or a directory.
+ */
+bool
+Server::resolve(const string & uri, uint32_t & first, uint32_t & last)
+{
+	if (parse_song(uri, first)) {
+		last = first + 1;
+		return true;
+	}
+
+	if (parse_directory(uri, first, last)) {
+		return true;
+	}
+
+	return fail(ACK_ERROR_NO_EXIST, "No such directory");
+}
+
+/*
+ * Recursive listing of the songs first..last-1, with the directories they
+ * are in. Each call generates about one chunk of output.
+ */
+generator
+Server::list_tree(uint32_t first, uint32_t last, bool meta) const
+{
+	uint32_t	n = first;
+
+	return [this, n, last, meta](string & out) mutable {
+		char	buffer[64];
+
+		while (n < last && out.size() < OUTPUT_CHUNK_SIZE) {
+			if (n % SONGS_PER_ARTIST == 0) {
+				snprintf(buffer, sizeof(buffer), "directory: artist%05u\n", n / SONGS_PER_ARTIST);
+				out += buffer;
+				if (meta) {
+					out += "Last-Modified: " SONG_MTIME "\n";
+				}
+			}
+			if (n % SONGS_PER_ALBUM == 0) {
+				snprintf(buffer, sizeof(buffer), "directory: artist%05u/album%06u\n",
+						n / SONGS_PER_ARTIST, n / SONGS_PER_ALBUM);
+				out += buffer;
+				if (meta) {
+					out += "Last-Modified: " SONG_MTIME "\n";
+				}
+			}
+			if (meta) {
+				print_song(out, n);
+			} else {
+				out += "file: " + song_uri(n) + "\n";
+			}
+			++n;
+		}
+
+		return (n < last);
+	};
+}
+
+/*
+ * Give the entries from 'from' onwards a new version, as seen by plchanges.
+ */
+void
+Server::queue_changed(uint32_t from)
+{
+	uint32_t	i;
+
+	++queue_version;
+
+	for (i = from; i < queue.size(); i++) {
+		queue[i].version = queue_version;
+	}
+
+	broadcast(EVENT_PLAYLIST);
+}
+
+void
+Server::queue_insert(uint32_t pos, const vector<uint32_t> & entries)
+{
+	vector<Queueentry>	inserted;
+	Queueentry		entry;
+	uint32_t		i;
+
+	for (i = 0; i < entries.size(); i++) {
+		entry.song = entries[i];
+		entry.id = next_id++;
+		entry.version = 0;
+		inserted.push_back(entry);
+	}
+
+	queue.insert(queue.begin() + pos, inserted.begin(), inserted.end());
+
+	if (current >= (int)pos) {
+		current += inserted.size();
+	}
+
+	queue_changed(pos);
+}
+
+void
+Server::queue_erase(uint32_t first, uint32_t last)
+{
+	queue.erase(queue.begin() + first, queue.begin() + last);
+
+	/* The current song was removed. Playback goes on with the next one,
+	 * or stops at the end of the queue. */
+	if (current >= (int)first && current < (int)last) {
+		if (state != STOPPED && first < queue.size()) {
+			start_song(first, 0);
+		} else {
+			state = STOPPED;
+			current = -1;
+			elapsed_ms = 0;
+		}
+		broadcast(EVENT_PLAYER);
+	} else if (current >= (int)last) {
+		current -= last - first;
+	}
+
+	queue_changed(first);
+}
+
+/*
+ * Move the entries first..last-1 so that the first of them ends up at 'to'.
+ */
+void
+Server::queue_move(uint32_t first, uint32_t last, uint32_t to)
+{
+	vector<Queueentry>	moved(queue.begin() + first, queue.begin() + last);
+	uint32_t		count = last - first;
+
+	if (to == first) {
+		return;
+	}
+
+	if (current >= (int)first && current < (int)last) {
+		current = current - first + to;
+	} else if (to < first && current >= (int)to && current < (int)first) {
+		current += count;
+	} else if (to > first && current >= (int)last && current < (int)(to + count)) {
+		current -= count;
+	}
+
+	queue.erase(queue.begin() + first, queue.begin() + last);
+	queue.insert(queue.begin() + to, moved.begin(), moved.end());
+
+	queue_changed(min(first, to));
+}
+
+int
+Server::find_id(uint32_t id) const
+{
+	uint32_t	i;
+
+	for (i = 0; i < queue.size(); i++) {
+		if (queue[i].id == id) {
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+void
+Server::print_entry(string & out, uint32_t pos) const
+{
+	char		buffer[64];
+
+	print_song(out, queue[pos].song);
+	snprintf(buffer, sizeof(buffer), "Pos: %u\nId: %u\n", pos, queue[pos].id);
+	out += buffer;
+}
+
+long long
+Server::elapsed() const
+{
+	return elapsed_ms + (state == PLAYING ? now_ms() - resumed : 0);
+}
+
+void
+Server::start_song(int pos, long long offset)
+{
+	current = pos;
+	elapsed_ms = offset;
+	resumed = now_ms();
+	if (state == STOPPED) {
+		state = PLAYING;
+	}
+}
+
+/*
+ * Go on to the next song once the current one has played to its end.
+ */
+void
+Server::advance()
+{
+	int		next;
+
+	while (state == PLAYING && current >= 0 && elapsed() >= song_duration(queue[current].song) * 1000LL) {
+
+		resumed += song_duration(queue[current].song) * 1000LL - elapsed_ms;
+		elapsed_ms = 0;
+
+		if (single && !repeat) {
+			state = STOPPED;
+		} else if (single) {
+			next = current;
+		} else if (random && queue.size() > 1) {
+			next = rand() % queue.size();
+		} else if ((uint32_t)current + 1 < queue.size()) {
+			next = current + 1;
+		} else if (repeat) {
+			next = 0;
+		} else {
+			state = STOPPED;
+		}
+
+		if (state == STOPPED) {
+			current = -1;
+		} else {
+			current = next;
+		}
+
+		broadcast(EVENT_PLAYER);
+	}
+}
+
+/*
+ * Time when the current song ends, or -1 if nothing is playing.
+ */
+long long
+Server::next_deadline() const
+{
+	if (state != PLAYING || current < 0) {
+		return -1;
+	}
+
+	return resumed + song_duration(queue[current].song) * 1000LL - elapsed_ms;
+}
+
+Storedplaylist *
+Server::find_playlist(const string & name)
+{
+	map<string, Storedplaylist>::iterator	it;
+
+	it = playlists.find(name);
+	if (it == playlists.end()) {
+		fail(ACK_ERROR_NO_EXIST, "No such playlist");
+		return NULL;
+	}
+
+	return &it->second;
+}
+
+/*
+ * Record a change to a stored playlist. Modification times have a resolution
+ * of one second, so they are bumped by at least that much, and clients which
+ * compare them see every change.
+ */
+void
+Server::touch_playlist(Storedplaylist & playlist)
+{
+	playlist.modified = max(time(NULL), playlist.modified + 1);
+	broadcast(EVENT_STORED_PLAYLIST);
+}
+
+bool
+Server::parse_number(const string & s, uint32_t & n)
+{
+	char *		end;
+	unsigned long	value;
+
+	errno = 0;
+	value = strtoul(s.c_str(), &end, 10);
+
+	if (s.empty() || *end != '\0' || errno != 0 || s[0] == '-' || value > 0xffffffffUL) {
+		return fail(ACK_ERROR_ARG, "Integer expected: %s", s.c_str());
+	}
+
+	n = value;
+
+	return true;
+}
+
+/*
+ * Parse a position or a START:END range of positions, where END may be left
+ * out. The result is first..last-1, which must lie within 'size' entries.
+ */
+bool
+Server::parse_range(const string & s, uint32_t size, uint32_t & first, uint32_t & last)
+{
+	size_t		colon = s.find(':');
+
+	if (colon == string::npos) {
+		if (!parse_number(s, first)) {
+			return false;
+		}
+		last = first + 1;
+	} else {
+		if (!parse_number(s.substr(0, colon), first)) {
+			return false;
+		}
+		if (colon + 1 == s.size()) {
+			last = max(first, size);
+		} else if (!parse_number(s.substr(colon + 1), last)) {
+			return false;
+		}
+	}
+
+	if (first > last || last > size || (first == last && first >= size && colon == string::npos)) {
+		return fail(ACK_ERROR_ARG, "Bad song index");
+	}
+
+	return true;
+}
+
+bool
+Server::parse_bool(const string & s, bool & value)
+{
+	if (s != "0" && s != "1") {
+		return fail(ACK_ERROR_ARG, "Boolean (0/1) expected: %s", s.c_str());
+	}
+
+	value = (s == "1");
+
+	return true;
+}
+
+bool
+Server::parse_name(const string & s)
+{
+	if (s.empty() || s.find_first_of("/\n\r") != string::npos) {
+		return fail(ACK_ERROR_ARG, "Bad playlist name");
+	}
+
+	return true;
+}
+
+/*
+ * Record changes in some subsystems for every client, and wake up those
+ * waiting for them.
+ */
+void
+Server::broadcast(unsigned int events)
+{
+	list<Client *>::iterator	it;
+
+	for (it = clients.begin(); it != clients.end(); ++it) {
+		(*it)->events |= events;
+		if ((*it)->idle && ((*it)->events & (*it)->idle_mask)) {
+			finish_idle(*it);
+		}
+	}
+}
+
+void
+Server::finish_idle(Client * client)
+{
+	Reply		reply;
+	unsigned int	i;
+
+	for (i = 0; event_names[i] != NULL; i++) {
+		if (client->events & client->idle_mask & (1 << i)) {
+			reply.print("changed: %s\n", event_names[i]);
+		}
+	}
+
+	reply.append("OK\n");
+
+	client->events &= ~client->idle_mask;
+	client->idle = false;
+
+	respond(client, reply, false);
+}
+
+void
+Server::respond(Client * client, Reply & reply, bool close_after)
+{
+	Response	response;
+
+	response.due = now_ms() + latency_ms;
+	response.offset = 0;
+	response.close_after = close_after;
+	reply.finish(response);
+
+	client->output.push_back(response);
+}
+
+void
+Server::handle_line(Client * client, const string & line)
+{
+	arguments	args;
+	Reply		reply;
+	unsigned int	i;
+	unsigned int	j;
+
+	if (!tokenize(line, args)) {
+		reply.append("ACK [5@0] {} Malformed command\n");
+		respond(client, reply, false);
+		return;
+	}
+
+	/* The only command accepted in IDLE is the one leaving it */
+	if (client->idle) {
+		if (args[0] != "noidle") {
+			client->closing = true;
+			return;
+		}
+		finish_idle(client);
+		return;
+	}
+
+	if (client->in_list) {
+		if (args[0] == "command_list_end") {
+			client->in_list = false;
+			run_commands(client, client->list, client->list_ok);
+			client->list.clear();
+		} else {
+			client->list.push_back(args);
+		}
+		return;
+	}
+
+	if (args[0] == "command_list_begin" || args[0] == "command_list_ok_begin") {
+		client->in_list = true;
+		client->list_ok = (args[0] == "command_list_ok_begin");
+		return;
+	}
+
+	if (args[0] == "noidle") {
+		reply.append("OK\n");
+		respond(client, reply, false);
+		return;
+	}
+
+	if (args[0] == "idle") {
+		client->idle_mask = (args.size() > 1 ? 0 : EVENT_ALL);
+		for (i = 1; i < args.size(); i++) {
+			for (j = 0; event_names[j] != NULL; j++) {
+				if (args[i] == event_names[j]) {
+					client->idle_mask |= (1 << j);
+				}
+			}
+		}
+		client->idle = true;
+		if (client->events & client->idle_mask) {
+			finish_idle(client);
+		}
+		return;
+	}
+
+	run_commands(client, vector<arguments>(1, args), false);
+}
+
+void
+Server::run_commands(Client * client, const vector<arguments> & commands, bool list_ok)
+{
+	Reply		reply;
+	unsigned int	i;
+	bool		close_after = false;
+
+	for (i = 0; i < commands.size(); i++) {
+		if (!run(commands[i], reply)) {
+			reply.print("ACK [%d@%u] {%s} %s\n", ack_code, i, commands[i][0].c_str(), ack_message.c_str());
+			respond(client, reply, false);
+			return;
+		}
+		if (commands[i][0] == "close") {
+			close_after = true;
+			break;
+		}
+		if (list_ok) {
+			reply.append("list_OK\n");
+		}
+	}
+
+	if (!close_after) {
+		reply.append("OK\n");
+	}
+
+	respond(client, reply, close_after);
+}
+
+/*
+ * Run a single command, adding its output to the reply.
+ *
+ * Returns false with ack_code and ack_message set if the command failed.
+ */
+bool
+Server::run(const arguments & args, Reply & reply)
+{
+	const string &					cmd = args[0];
+	map<string, Storedplaylist>::iterator		it;
+	Storedplaylist *				playlist;
+	Storedplaylist					created;
+	vector<uint32_t>				entries;
+	string						out;
+	uint32_t					first;
+	uint32_t					last;
+	uint32_t					pos;
+	uint32_t					n;
+	uint32_t					i;
+	int						index;
+	bool						flag;
+
+	static const char * const	commands[] = {
+		"add", "addid", "clear", "close", "command_list_begin",
+		"command_list_end", "command_list_ok_begin", "commands", "consume",
+		"crossfade", "currentsong", "delete", "deleteid", "idle",
+		"listall", "listallinfo", "listplaylist", "listplaylistinfo",
+		"listplaylists", "load", "lsinfo", "move", "moveid", "next",
+		"noidle", "notcommands", "outputs", "password", "pause", "ping",
+		"play", "playid", "playlistadd", "playlistclear", "playlistdelete",
+		"playlistid", "playlistinfo", "playlistmove", "plchanges",
+		"plchangesposid", "previous", "random", "rename", "repeat",
+		"rescan", "rm", "save", "seek", "seekcur", "seekid", "setvol",
+		"shuffle", "single", "stats", "status", "stop", "tagtypes",
+		"update", NULL
+	};
+
+	advance();
+
+	/* Commands which take no arguments, or optional ones */
+	if (cmd == "ping" || cmd == "close") {
+		return true;
+	}
+
+	if (cmd == "password") {
+		if (args.size() != 2) {
+			return fail(ACK_ERROR_ARG, "wrong number of arguments for \"%s\"", cmd.c_str());
+		}
+		if (args[1] != password) {
+			return fail(ACK_ERROR_PASSWORD, "incorrect password");
+		}
+		return true;
+	}
+
+	if (cmd == "commands") {
+		for (i = 0; commands[i] != NULL; i++) {
+			reply.print("command: %s\n", commands[i]);
+		}
+		return true;
+	}
+
+	if (cmd == "notcommands") {
+		return true;
+	}
+
+	if (cmd == "tagtypes") {
+		reply.append("tagtype: Artist\ntagtype: AlbumArtist\ntagtype: Title\n"
+				"tagtype: Album\ntagtype: Track\ntagtype: Date\ntagtype: Genre\n");
+		return true;
+	}
+
+	if (cmd == "outputs") {
+		reply.append("outputid: 0\noutputname: Fake output\nplugin: null\noutputenabled: 1\n");
+		return true;
+	}
+
+	if (cmd == "status") {
+		reply.print("volume: %d\nrepeat: %d\nrandom: %d\nsingle: %d\nconsume: %d\n",
+				volume, repeat, random, single, consume);
+		reply.print("partition: default\nplaylist: %u\nplaylistlength: %u\nmixrampdb: 0.000000\n",
+				queue_version, (uint32_t)queue.size());
+		reply.print("state: %s\n", (state == PLAYING ? "play" : (state == PAUSED ? "pause" : "stop")));
+		if (crossfade > 0) {
+			reply.print("xfade: %d\n", crossfade);
+		}
+		if (current >= 0) {
+			n = queue[current].song;
+			reply.print("song: %d\nsongid: %u\n", current, queue[current].id);
+			if ((uint32_t)current + 1 < queue.size()) {
+				reply.print("nextsong: %d\nnextsongid: %u\n", current + 1, queue[current + 1].id);
+			}
+			if (state != STOPPED) {
+				reply.print("time: %lld:%d\nelapsed: %lld.%03lld\nbitrate: 320\nduration: %d.000\naudio: 44100:16:2\n",
+						elapsed() / 1000, song_duration(n),
+						elapsed() / 1000, elapsed() % 1000,
+						song_duration(n));
+			}
+		}
+		return true;
+	}
+
+	if (cmd == "stats") {
+		reply.print("artists: %u\nalbums: %u\nsongs: %u\nuptime: %ld\nplaytime: %ld\ndb_playtime: %lu\ndb_update: %ld\n",
+				(songs + SONGS_PER_ARTIST - 1) / SONGS_PER_ARTIST,
+				(songs + SONGS_PER_ALBUM - 1) / SONGS_PER_ALBUM,
+				songs, (long)(time(NULL) - started), (long)(time(NULL) - started),
+				db_playtime, (long)db_update);
+		return true;
+	}
+
+	if (cmd == "currentsong") {
+		if (current >= 0) {
+			print_entry(out, current);
+			reply.append(out);
+		}
+		return true;
+	}
+
+	/* Database */
+	if (cmd == "listallinfo" || cmd == "listall") {
+		if (!resolve(args.size() > 1 ? args[1] : "", first, last)) {
+			return false;
+		}
+		reply.stream(list_tree(first, last, cmd == "listallinfo"));
+		return true;
+	}
+
+	if (cmd == "lsinfo") {
+		if (args.size() > 1 && parse_song(args[1], n)) {
+			print_song(out, n);
+			reply.append(out);
+			return true;
+		}
+		if (!resolve(args.size() > 1 ? args[1] : "", first, last)) {
+			return false;
+		}
+		if (args.size() < 2 || args[1].empty() || args[1] == "/") {
+			/* The root holds the artists, and the stored playlists */
+			for (n = 0; n < last; n += SONGS_PER_ARTIST) {
+				reply.print("directory: artist%05u\nLast-Modified: " SONG_MTIME "\n", n / SONGS_PER_ARTIST);
+			}
+			for (it = playlists.begin(); it != playlists.end(); ++it) {
+				reply.print("playlist: %s\nLast-Modified: %s\n", it->first.c_str(), iso8601(it->second.modified).c_str());
+			}
+		} else if (args[1].find('/') == string::npos) {
+			for (n = first; n < last; n += SONGS_PER_ALBUM) {
+				reply.print("directory: artist%05u/album%06u\nLast-Modified: " SONG_MTIME "\n",
+						n / SONGS_PER_ARTIST, n / SONGS_PER_ALBUM);
+			}
+		} else {
+			for (n = first; n < last; n++) {
+				print_song(out, n);
+			}
+			reply.append(out);
+		}
+		return true;
+	}
+
+	if (cmd == "update" || cmd == "rescan") {
+		/* Nothing changes, but the update finishes at once, and clients
+		 * see a new database update time */
+		reply.print("updating_db: %d\n", ++update_job);
+		db_update = max(time(NULL), db_update + 1);
+		broadcast(EVENT_DATABASE | EVENT_UPDATE);
+		return true;
+	}
+
+	/* Queue */
+	if (cmd == "add" || cmd == "addid") {
+		if (args.size() < 2 || args.size() > 3) {
+			return fail(ACK_ERROR_ARG, "wrong number of arguments for \"%s\"", cmd.c_str());
+		}
+		if (cmd == "addid" && !parse_song(args[1], first)) {
+			return fail(ACK_ERROR_NO_EXIST, "No such song");
+		}
+		if (cmd == "addid") {
+			last = first + 1;
+		} else if (!resolve(args[1], first, last)) {
+			return false;
+		}
+		pos = queue.size();
+		if (args.size() > 2 && !parse_number(args[2], pos)) {
+			return false;
+		}
+		if (pos > queue.size()) {
+			return fail(ACK_ERROR_ARG, "Bad song index");
+		}
+		for (n = first; n < last; n++) {
+			entries.push_back(n);
+		}
+		queue_insert(pos, entries);
+		if (cmd == "addid") {
+			reply.print("Id: %u\n", queue[pos].id);
+		}
+		return true;
+	}
+
+	if (cmd == "delete") {
+		if (args.size() != 2 || !parse_range(args[1], queue.size(), first, last)) {
+			return (args.size() != 2 ? fail(ACK_ERROR_ARG, "wrong number of arguments for \"%s\"", cmd.c_str()) : false);
+		}
+		queue_erase(first, last);
+		return true;
+	}
+
+	if (cmd == "deleteid") {
+		if (args.size() != 2 || !parse_number(args[1], n)) {
+			return (args.size() != 2 ? fail(ACK_ERROR_ARG, "wrong number of arguments for \"%s\"", cmd.c_str()) : false);
+		}
+		if ((index = find_id(n)) < 0) {
+			return fail(ACK_ERROR_NO_EXIST, "No such song");
+		}
+		queue_erase(index, index + 1);
+		return true;
+	}
+
+	if (cmd == "move" || cmd == "moveid") {
+		if (args.size() != 3) {
+			return fail(ACK_ERROR_ARG, "wrong number of arguments for \"%s\"", cmd.c_str());
+		}
+		if (cmd == "moveid") {
+			if (!parse_number(args[1], n)) {
+				return false;
+			}
+			if ((index = find_id(n)) < 0) {
+				return fail(ACK_ERROR_NO_EXIST, "No such song");
+			}
+			first = index;
+			last = first + 1;
+		} else if (!parse_range(args[1], queue.size(), first, last)) {
+			return false;
+		}
+		if (!parse_number(args[2], pos)) {
+			return false;
+		}
+		if (pos + (last - first) > queue.size()) {
+			return fail(ACK_ERROR_ARG, "Bad song index");
+		}
+		queue_move(first, last, pos);
+		return true;
+	}
+
+	if (cmd == "clear") {
+		queue_erase(0, queue.size());
+		return true;
+	}
+
+	if (cmd == "shuffle") {
+		for (i = queue.size(); i > 1; i--) {
+			n = rand() % i;
+			swap(queue[i - 1], queue[n]);
+			if (current == (int)n) {
+				current = i - 1;
+			} else if (current == (int)i - 1) {
+				current = n;
+			}
+		}
+		queue_changed(0);
+		return true;
+	}
+
+	if (cmd == "playlistinfo") {
+		first = 0;
+		last = queue.size();
+		if (args.size() > 1 && !parse_range(args[1], queue.size(), first, last)) {
+			return false;
+		}
+		reply.stream([this, first, last](string & out) mutable {
+			/* The queue may shrink while the listing is sent */
+			while (first < last && first < queue.size() && out.size() < OUTPUT_CHUNK_SIZE) {
+				print_entry(out, first++);
+			}
+			return (first < last && first < queue.size());
+		});
+		return true;
+	}
+
+	if (cmd == "playlistid") {
+		if (args.size() < 2) {
+			first = 0;
+			reply.stream([this, first](string & out) mutable {
+				while (first < queue.size() && out.size() < OUTPUT_CHUNK_SIZE) {
+					print_entry(out, first++);
+				}
+				return (first < queue.size());
+			});
+			return true;
+		}
+		if (!parse_number(args[1], n)) {
+			return false;
+		}
+		if ((index = find_id(n)) < 0) {
+			return fail(ACK_ERROR_NO_EXIST, "No such song");
+		}
+		print_entry(out, index);
+		reply.append(out);
+		return true;
+	}
+
+	if (cmd == "plchanges" || cmd == "plchangesposid") {
+		if (args.size() < 2 || !parse_number(args[1], n)) {
+			return (args.size() < 2 ? fail(ACK_ERROR_ARG, "wrong number of arguments for \"%s\"", cmd.c_str()) : false);
+		}
+		flag = (cmd == "plchanges");
+		i = 0;
+		reply.stream([this, n, flag, i](string & out) mutable {
+			char	buffer[64];
+
+			while (i < queue.size() && out.size() < OUTPUT_CHUNK_SIZE) {
+				if (queue[i].version > n) {
+					if (flag) {
+						print_entry(out, i);
+					} else {
+						snprintf(buffer, sizeof(buffer), "cpos: %u\nId: %u\n", i, queue[i].id);
+						out += buffer;
+					}
+				}
+				++i;
+			}
+			return (i < queue.size());
+		});
+		return true;
+	}
+
+	/* Player */
+	if (cmd == "play" || cmd == "playid") {
+		if (args.size() > 1) {
+			if (!parse_number(args[1], n)) {
+				return false;
+			}
+			index = (cmd == "playid" ? find_id(n) : (n < queue.size() ? (int)n : -1));
+			if (index < 0) {
+				return fail(ACK_ERROR_NO_EXIST, "No such song");
+			}
+			state = STOPPED;
+			start_song(index, 0);
+		} else if (state == PAUSED) {
+			state = PLAYING;
+			resumed = now_ms();
+		} else if (state == STOPPED && !queue.empty()) {
+			start_song(current >= 0 ? current : 0, 0);
+		}
+		broadcast(EVENT_PLAYER);
+		return true;
+	}
+
+	if (cmd == "pause") {
+		if (state == STOPPED) {
+			return true;
+		}
+		flag = (state == PLAYING);
+		if (args.size() > 1 && !parse_bool(args[1], flag)) {
+			return false;
+		}
+		if (flag && state == PLAYING) {
+			elapsed_ms = elapsed();
+			state = PAUSED;
+		} else if (!flag && state == PAUSED) {
+			resumed = now_ms();
+			state = PLAYING;
+		}
+		broadcast(EVENT_PLAYER);
+		return true;
+	}
+
+	if (cmd == "stop") {
+		state = STOPPED;
+		elapsed_ms = 0;
+		broadcast(EVENT_PLAYER);
+		return true;
+	}
+
+	if (cmd == "next" || cmd == "previous") {
+		if (state == STOPPED || current < 0) {
+			return true;
+		}
+		index = current + (cmd == "next" ? 1 : -1);
+		if (index < 0 || index >= (int)queue.size()) {
+			state = STOPPED;
+			current = -1;
+			elapsed_ms = 0;
+		} else {
+			start_song(index, 0);
+		}
+		broadcast(EVENT_PLAYER);
+		return true;
+	}
+
+	if (cmd == "seek" || cmd == "seekid" || cmd == "seekcur") {
+		if (args.size() != (cmd == "seekcur" ? 2U : 3U)) {
+			return fail(ACK_ERROR_ARG, "wrong number of arguments for \"%s\"", cmd.c_str());
+		}
+		if (cmd == "seekcur") {
+			index = current;
+		} else if (!parse_number(args[1], n)) {
+			return false;
+		} else {
+			index = (cmd == "seekid" ? find_id(n) : (n < queue.size() ? (int)n : -1));
+		}
+		if (index < 0) {
+			return fail(ACK_ERROR_NO_EXIST, "No such song");
+		}
+		flag = (state == PAUSED);
+		start_song(index, (long long)(atof(args.back().c_str()) * 1000));
+		if (flag) {
+			state = PAUSED;
+		}
+		broadcast(EVENT_PLAYER);
+		return true;
+	}
+
+	if (cmd == "setvol") {
+		if (args.size() != 2 || !parse_number(args[1], n) || n > 100) {
+			return fail(ACK_ERROR_ARG, "Invalid volume value");
+		}
+		volume = n;
+		broadcast(EVENT_MIXER);
+		return true;
+	}
+
+	if (cmd == "repeat" || cmd == "random" || cmd == "single" || cmd == "consume") {
+		if (args.size() != 2 || !parse_bool(args[1], flag)) {
+			return (args.size() != 2 ? fail(ACK_ERROR_ARG, "wrong number of arguments for \"%s\"", cmd.c_str()) : false);
+		}
+		(cmd == "repeat" ? repeat : cmd == "random" ? random : cmd == "single" ? single : consume) = flag;
+		broadcast(EVENT_OPTIONS);
+		return true;
+	}
+
+	if (cmd == "crossfade") {
+		if (args.size() != 2 || !parse_number(args[1], n)) {
+			return (args.size() != 2 ? fail(ACK_ERROR_ARG, "wrong number of arguments for \"%s\"", cmd.c_str()) : false);
+		}
+		crossfade = n;
+		broadcast(EVENT_OPTIONS);
+		return true;
+	}
+
+	/* Stored playlists */
+	if (cmd == "listplaylists") {
+		for (it = playlists.begin(); it != playlists.end(); ++it) {
+			reply.print("playlist: %s\nLast-Modified: %s\n", it->first.c_str(), iso8601(it->second.modified).c_str());
+		}
+		return true;
+	}
+
+	if (args.size() < 2) {
+		for (i = 0; commands[i] != NULL; i++) {
+			if (cmd == commands[i]) {
+				return fail(ACK_ERROR_ARG, "wrong number of arguments for \"%s\"", cmd.c_str());
+			}
+		}
+		return fail(ACK_ERROR_UNKNOWN, "unknown command \"%s\"", cmd.c_str());
+	}
+
+	if (cmd == "listplaylist" || cmd == "listplaylistinfo") {
+		if ((playlist = find_playlist(args[1])) == NULL) {
+			return false;
+		}
+		first = 0;
+		last = playlist->songs.size();
+		if (args.size() > 2 && !parse_range(args[2], playlist->songs.size(), first, last)) {
+			return false;
+		}
+		for (i = first; i < last; i++) {
+			if (cmd == "listplaylistinfo") {
+				print_song(out, playlist->songs[i]);
+			} else {
+				out += "file: " + song_uri(playlist->songs[i]) + "\n";
+			}
+		}
+		reply.append(out);
+		return true;
+	}
+
+	if (cmd == "playlistadd") {
+		if (args.size() < 3 || !parse_name(args[1])) {
+			return (args.size() < 3 ? fail(ACK_ERROR_ARG, "wrong number of arguments for \"%s\"", cmd.c_str()) : false);
+		}
+		if (!resolve(args[2], first, last)) {
+			return false;
+		}
+		playlist = &playlists[args[1]];
+		pos = playlist->songs.size();
+		if (args.size() > 3 && (!parse_number(args[3], pos) || pos > playlist->songs.size())) {
+			return fail(ACK_ERROR_ARG, "Bad song index");
+		}
+		for (n = first; n < last; n++) {
+			playlist->songs.insert(playlist->songs.begin() + pos++, n);
+		}
+		touch_playlist(*playlist);
+		return true;
+	}
+
+	if (cmd == "playlistdelete") {
+		if (args.size() != 3) {
+			return fail(ACK_ERROR_ARG, "wrong number of arguments for \"%s\"", cmd.c_str());
+		}
+		if ((playlist = find_playlist(args[1])) == NULL || !parse_range(args[2], playlist->songs.size(), first, last)) {
+			return false;
+		}
+		playlist->songs.erase(playlist->songs.begin() + first, playlist->songs.begin() + last);
+		touch_playlist(*playlist);
+		return true;
+	}
+
+	if (cmd == "playlistmove") {
+		if (args.size() != 4) {
+			return fail(ACK_ERROR_ARG, "wrong number of arguments for \"%s\"", cmd.c_str());
+		}
+		if ((playlist = find_playlist(args[1])) == NULL || !parse_range(args[2], playlist->songs.size(), first, last)
+				|| !parse_number(args[3], pos)) {
+			return false;
+		}
+		if (pos + (last - first) > playlist->songs.size()) {
+			return fail(ACK_ERROR_ARG, "Bad song index");
+		}
+		vector<uint32_t> moved(playlist->songs.begin() + first, playlist->songs.begin() + last);
+		playlist->songs.erase(playlist->songs.begin() + first, playlist->songs.begin() + last);
+		playlist->songs.insert(playlist->songs.begin() + pos, moved.begin(), moved.end());
+		touch_playlist(*playlist);
+		return true;
+	}
+
+	if (cmd == "playlistclear") {
+		if (!parse_name(args[1])) {
+			return false;
+		}
+		playlist = &playlists[args[1]];
+		playlist->songs.clear();
+		touch_playlist(*playlist);
+		return true;
+	}
+
+	if (cmd == "save") {
+		if (!parse_name(args[1])) {
+			return false;
+		}
+		if (playlists.count(args[1])) {
+			return fail(ACK_ERROR_EXIST, "Playlist already exists");
+		}
+		created.modified = 0;
+		for (i = 0; i < queue.size(); i++) {
+			created.songs.push_back(queue[i].song);
+		}
+		playlist = &(playlists[args[1]] = created);
+		touch_playlist(*playlist);
+		return true;
+	}
+
+	if (cmd == "load") {
+		if ((playlist = find_playlist(args[1])) == NULL) {
+			return false;
+		}
+		queue_insert(queue.size(), playlist->songs);
+		return true;
+	}
+
+	if (cmd == "rm") {
+		if (!find_playlist(args[1])) {
+			return false;
+		}
+		playlists.erase(args[1]);
+		broadcast(EVENT_STORED_PLAYLIST);
+		return true;
+	}
+
+	if (cmd == "rename") {
+		if (args.size() != 3) {
+			return fail(ACK_ERROR_ARG, "wrong number of arguments for \"%s\"", cmd.c_str());
+		}
+		if ((playlist = find_playlist(args[1])) == NULL || !parse_name(args[2])) {
+			return false;
+		}
+		if (playlists.count(args[2])) {
+			return fail(ACK_ERROR_EXIST, "Playlist already exists");
+		}
+		created = *playlist;
+		playlists.erase(args[1]);
+		touch_playlist(playlists[args[2]] = created);
+		return true;
+	}
+
+	return fail(ACK_ERROR_UNKNOWN, "unknown command \"%s\"", cmd.c_str());
+}
+
+bool
+Server::listen(const char * address, int port)
+{
+	struct sockaddr_in	addr;
+	int			one = 1;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+
+	if (inet_pton(AF_INET, address, &addr.sin_addr) != 1) {
+		fprintf(stderr, "fakempd: invalid address: %s\n", address);
+		return false;
+	}
+
+	if ((listener = socket(AF_INET, SOCK_STREAM, 0)) == -1) {
+		perror("fakempd: socket");
+		return false;
+	}
+
+	setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+	if (bind(listener, (struct sockaddr *)&addr, sizeof(addr)) == -1 || ::listen(listener, 16) == -1) {
+		perror("fakempd: bind");
+		return false;
+	}
+
+	fcntl(listener, F_SETFL, O_NONBLOCK);
+
+	return true;
+}
+
+void
+Server::accept_client()
+{
+	Client *	client;
+	Reply		reply;
+	int		fd;
+
+	if ((fd = accept(listener, NULL, NULL)) == -1) {
+		return;
+	}
+
+	fcntl(fd, F_SETFL, O_NONBLOCK);
+
+	client = new Client;
+	client->fd = fd;
+	client->closing = false;
+	client->in_list = false;
+	client->list_ok = false;
+	client->idle = false;
+	client->idle_mask = 0;
+	client->events = 0;
+
+	clients.push_back(client);
+
+	/* The greeting is not delayed, so that connecting is never slow */
+	reply.append("OK MPD " PROTOCOL_VERSION "\n");
+	respond(client, reply, false);
+	client->output.back().due = 0;
+}
+
+/*
+ * Read and run commands from a client.
+ *
+ * Returns false if the connection should be closed.
+ */
+bool
+Server::read_client(Client * client)
+{
+	char		buffer[4096];
+	ssize_t		count;
+	size_t		newline;
+
+	count = read(client->fd, buffer, sizeof(buffer));
+	if (count == 0 || (count == -1 && errno != EAGAIN && errno != EINTR)) {
+		return false;
+	}
+	if (count == -1) {
+		return true;
+	}
+
+	client->input.append(buffer, count);
+
+	while (!client->closing && (newline = client->input.find('\n')) != string::npos) {
+		handle_line(client, client->input.substr(0, newline));
+		client->input.erase(0, newline + 1);
+	}
+
+	return (!client->closing && client->input.size() < MAX_LINE_LENGTH);
+}
+
+/*
+ * Send due responses to a client, as far as the socket allows.
+ *
+ * Returns false if the connection should be closed.
+ */
+bool
+Server::write_client(Client * client)
+{
+	Response *	response;
+	ssize_t		count;
+
+	while (!client->output.empty()) {
+		response = &client->output.front();
+
+		if (response->due > now_ms()) {
+			return true;
+		}
+
+		/* Generate more output when the buffer has been sent */
+		if (response->offset == response->buffer.size()) {
+			response->buffer.clear();
+			response->offset = 0;
+			while (!response->parts.empty() && response->buffer.size() < OUTPUT_CHUNK_SIZE) {
+				if (!response->parts.front()(response->buffer)) {
+					response->parts.pop_front();
+				}
+			}
+		}
+
+		if (response->offset < response->buffer.size()) {
+			count = write(client->fd, response->buffer.data() + response->offset, response->buffer.size() - response->offset);
+			if (count == -1) {
+				return (errno == EAGAIN || errno == EINTR);
+			}
+			response->offset += count;
+			if (response->offset < response->buffer.size()) {
+				return true;
+			}
+		}
+
+		if (response->parts.empty()) {
+			if (response->close_after) {
+				return false;
+			}
+			client->output.pop_front();
+		}
+	}
+
+	return !client->closing;
+}
+
+void
+Server::loop()
+{
+	vector<struct pollfd>		fds;
+	vector<Client *>		polled;
+	list<Client *>::iterator	it;
+	struct pollfd			pfd;
+	long long			now;
+	long long			wakeup;
+	Client *			client;
+	bool				alive;
+	unsigned int			i;
+
+	while (true) {
+
+		advance();
+
+		fds.clear();
+		polled.clear();
+		now = now_ms();
+		wakeup = next_deadline();
+
+		pfd.fd = listener;
+		pfd.events = POLLIN;
+		fds.push_back(pfd);
+
+		for (it = clients.begin(); it != clients.end(); ++it) {
+			client = *it;
+			pfd.fd = client->fd;
+			pfd.events = POLLIN;
+			if (!client->output.empty()) {
+				if (client->output.front().due <= now) {
+					pfd.events |= POLLOUT;
+				} else if (wakeup == -1 || client->output.front().due < wakeup) {
+					wakeup = client->output.front().due;
+				}
+			}
+			fds.push_back(pfd);
+			polled.push_back(client);
+		}
+
+		if (poll(&fds[0], fds.size(), (wakeup == -1 ? -1 : (int)max(0LL, wakeup - now))) == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			perror("fakempd: poll");
+			return;
+		}
+
+		advance();
+
+		for (i = 0; i < polled.size(); i++) {
+			client = polled[i];
+			alive = true;
+
+			if (fds[i + 1].revents & (POLLIN | POLLHUP | POLLERR)) {
+				alive = read_client(client);
+			}
+			if (alive) {
+				alive = write_client(client);
+			}
+
+			if (!alive) {
+				close(client->fd);
+				clients.remove(client);
+				delete client;
+			}
+		}
+
+		if (fds[0].revents & POLLIN) {
+			accept_client();
+		}
+	}
+}
+
+
+static void
+usage()
+{
+	fprintf(stderr,
+		"Usage: fakempd [OPTION]...\n"
+		"Serve a synthetic music library over the MPD protocol.\n"
+		"\n"
+		"  --port N          listen on port N (default 6600)\n"
+		"  --bind ADDRESS    listen on IPv4 ADDRESS (default 127.0.0.1)\n"
+		"  --songs N         number of songs in the library (default 1000)\n"
+		"  --latency-ms M    delay every response by M milliseconds (default 0)\n"
+		"  --password WORD   password accepted by the password command\n");
+}
+
+int
+main(int argc, char * argv[])
+{
+	const char *	address = "127.0.0.1";
+	string		password;
+	long		port = 6600;
+	long		songs = 1000;
+	long		latency_ms = 0;
+	int		i;
+
+	for (i = 1; i < argc; i++) {
+		if (i + 1 < argc && !strcmp(argv[i], "--port")) {
+			port = atol(argv[++i]);
+		} else if (i + 1 < argc && !strcmp(argv[i], "--bind")) {
+			address = argv[++i];
+		} else if (i + 1 < argc && !strcmp(argv[i], "--songs")) {
+			songs = atol(argv[++i]);
+		} else if (i + 1 < argc && !strcmp(argv[i], "--latency-ms")) {
+			latency_ms = atol(argv[++i]);
+		} else if (i + 1 < argc && !strcmp(argv[i], "--password")) {
+			password = argv[++i];
+		} else {
+			usage();
+			return (strcmp(argv[i], "--help") ? 1 : 0);
+		}
+	}
+
+	if (port <= 0 || port > 65535 || songs < 0 || songs > MAX_SONGS || latency_ms < 0) {
+		usage();
+		return 1;
+	}
+
+	signal(SIGPIPE, SIG_IGN);
+
+	Server server(songs, latency_ms, password);
+
+	if (!server.listen(address, port)) {
+		return 1;
+	}
+
+	fprintf(stderr, "fakempd: serving %ld songs on %s:%ld\n", songs, address, port);
+
+	server.loop();
+
+	return 1;
+}